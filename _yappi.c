@@ -9,6 +9,9 @@
 
 #include "Python.h"
 #include "frameobject.h"
+#include "pythread.h"
+#include "marshal.h"
+#include <sys/stat.h>
 #include "_ycallstack.h"
 #include "_yhashtab.h"
 #include "_ydebug.h"
@@ -16,20 +19,82 @@
 #include "_yfreelist.h"
 #include "_ystatic.h"
 #include "_ymem.h"
+#include "_yhist.h"
+#include "_yring.h"
+#include "_ytrace.h"
+#include "_yqueue.h"
+#include "_ydump.h"
+#include "_yshm.h"
 
 // module macros
 #define YSTRMOVEND(s) (*s += strlen(*s))
+#define ICACHE_SLOT(key) ((((uintptr_t)(key)) >> 4) & (PIT_CACHE_SIZE-1))
 
 // module definitions
 typedef struct {
-    PyObject *co; // CodeObject or MethodDef descriptive string.
+    // hot: the fields used on every call of the function. They fit into the
+    // first cache line, pits are cache line aligned by the freelist.
     unsigned long callcount;
     long long tsubtotal;
     long long ttotal;
     int builtin;
     int cpc;
+    _hist *hist; // per-call latency histogram, NULL if not enabled for the pit.
+    long long slow_threshold; // in ticks, 0 disables the capture, -1 means the global threshold applies.
+    _shmpit *shm; // live record of the pit, NULL if not published.
+    struct _lineprof *lines; // per-line stats, NULL if the function is not line profiled.
+    // warm: the generator counters, only updated on the calls of generators,
+    // and the cold call counters, updated on the first and the sampled calls.
+    // They fit into the second cache line.
+    unsigned long resumes; // generator resumes, not counted as calls.
+    unsigned long nlife; // finished generator calls
+    long long tlife; // from the first call to the end of the finished generators
+    unsigned int ncold; // finished calls of the first flags.cold_calls
+    unsigned int nentered; // cold calls entered, not reset by the agent
+    long long tfirst; // the first finished call
+    long long tcold; // the cold calls, recursive ones are not added like in ttotal
+    unsigned long nsteady; // finished calls after the cold ones that were timed
+    long long tsteady; // the timed calls after the cold ones, like tcold
+    // cold: only used when the pit is created or the stats are read.
+    PyObject *co; // CodeObject or MethodDef descriptive string.
+    unsigned int id;
+    PyObject *ident; // interned filename:name:line, the key of the pit in dedup mode.
+    PyObject *name; // display name, formatted on first use.
+    struct _tag *tag; // the tag the calls were made under, NULL if untagged.
 } _pit; // profile_item
 
+// fail to compile if a new field pushes the hot or warm group out of its line.
+typedef char _pit_hot_fits[(offsetof(_pit, resumes) <= YCACHELINE) ? 1 : -1];
+typedef char _pit_warm_fits[(offsetof(_pit, co) <= 2*YCACHELINE) ? 1 : -1];
+
+typedef struct {
+    unsigned long hits;
+    long long ttotal; // from the start of the line to the next one, calls included.
+} _linestat;
+
+typedef struct _lineprof {
+    int first; // line number of lines[0], the first line of the code
+    int count;
+    _linestat lines[1];
+} _lineprof; // per-line stats of a function selected for line profiling
+
+typedef struct {
+    PyFrameObject *frame;
+    _pit *pit;
+    int line; // index of the running line in pit->lines, -1 if none
+    long long t; // start of the running line
+} _lnframe; // running frame of a line profiled function
+
+typedef struct {
+    void *key; // code object or PyMethodDef of a C function
+    _pit *pit;
+} _icentry; // entry of the per-context pit cache
+
+typedef struct _tag {
+    PyObject *name;
+    _htab *pits; // the pits of the tag, keyed like the pits table.
+} _tag; // tag set by set_tag(), the calls made under it have their own pits
+
 typedef struct {
     _cstack *cs;
     long id;
@@ -37,13 +102,62 @@ typedef struct {
     unsigned long sched_cnt;
     long long ttotal;
     char *class_name;
+    _trace *trace; // event trace of the thread in trace mode.
+    _queue *evq; // events waiting for the aggregator in deferred mode.
+    _shmctx *shm; // live record of the context, NULL if not published.
+    unsigned long gen; // tells the context apart from a recycled one.
+    unsigned long ichits;
+    unsigned long icmisses;
+    _icentry icache[PIT_CACHE_SIZE]; // direct mapped cache in front of the pits table.
+    int lndepth; // running frames of line profiled functions, may exceed LINE_STACK_DEPTH.
+    _lnframe lnstack[LINE_STACK_DEPTH];
+    int seeded; // callstack items of frames that were running when profiling started.
+    _tag *tag; // current tag of the thread, NULL if untagged.
+    int task; // keyed by the id of the context id callback instead of the thread.
 } _ctx; // context
 
 typedef struct {
     int builtins;
     int timing_sample;
+    int latency_hist;
+    int deferred;
+    int dedup;
+    int cold_calls;
 } _flag; // flags passed from yappi.start()
 
+typedef struct {
+    long tid;
+    double tstart;
+    long long elapsed;
+    int depth; // real callstack depth, may be bigger than SLOW_STACK_DEPTH.
+    int nframes;
+    void *frames[SLOW_STACK_DEPTH]; // outermost first, the slow call is the last.
+} _slowcall; // a call that exceeded the slow call threshold
+
+typedef struct {
+    void *pit; // NULL for a return event.
+    long long t;
+    int resume; // the call resumes a generator.
+    int ccall; // the return is of a C function.
+} _defevent; // event queued for the aggregator in deferred mode
+
+typedef struct {
+    long long tstart;
+    _pit *pit;
+} _gen; // a running generator call
+
+typedef struct {
+    unsigned long lookups;
+    unsigned long probes;
+    unsigned long grows;
+    long long growtime;
+} _htstats; // hash table counters summed over tables
+
+typedef struct {
+    _htstats counts; // the tables counting the items on the callstacks
+    unsigned long grows;
+} _csstats; // callstack counters summed over contexts
+
 
 // stat related definitions
 typedef struct {
@@ -68,9 +182,61 @@ static PyObject *YappiProfileError;
 static _statnode *statshead;
 static _htab *contexts;
 static _htab *pits;
+static _htab *codes; // code object -> pit in dedup mode, removed when the code dies.
+static _htab *gens; // generator frame -> _gen, until the generator finishes.
+static _htab *tags; // hash of the tag name -> _tag, colliding ones on the next key.
+static _tag *tagfilter; // stats only list the pits of this tag if set.
+static _htab *tasks; // id of the context id callback -> _ctx
+static PyObject *ctxidcb; // returns the id of the running task, NULL for threads.
+static long (*ctxidfn)(void); // native context id callback, set with ctxidcb.
+static PyObject *coderefs; // code object address -> weakref of the code in dedup mode.
 static _flag flags;
+static PyObject *histfilter; // function names that get a latency histogram, NULL for all.
+static PyObject *slowfilter; // function name -> per-function slow call threshold.
+static PyObject *linefilter; // function names that are line profiled, NULL for none.
+static long long slow_threshold;
+static _ring *slowcalls;
+static PyObject *tracedir; // set while the profiler runs in trace mode.
+static unsigned long long tracesize;
+static FILE *tracenames;
+static unsigned int pitcount; // last assigned pit id
+static struct _tag *newtag; // the tag of the pits created by _tag2pit(), NULL otherwise.
+static unsigned long maxmem; // memory budget of the profiler, 0 for none.
+static _pit *otherpit; // functions that do not fit into maxmem are folded into it.
+static unsigned long foldedcalls;
+static PyThread_type_lock agglock; // serializes the consumers of the deferred queues
+static PyThread_type_lock aggexit; // released by the aggregator thread on exit
+static volatile int aggrunning;
+static _shm *shm; // set while the stats are published to shared memory.
+static PyThread_type_lock agentexit; // released by the agent thread on exit
+static volatile int agentrunning;
+static PyObject *agentprefix; // path prefix of the profiles the agent writes.
+static char *agenttype;
+static double agentinterval; // secs between two profiles
+static long long agentmaxbytes; // disk budget of the written profiles
+static long long agentbytes;
+static unsigned int agentseq; // keeps the names of profiles of the same second apart.
+static int agentreset;
+static PyObject *agentfiles; // (path, size) of the written profiles, oldest first.
+static int dumperr; // set if a pit or a context cannot be added to a dump
 static _freelist *flpit;
 static _freelist *flctx;
+static _freelist *flgen;
+static _cstack *cspool[CS_POOL_SIZE]; // callstacks of retired contexts
+static int cspoolcnt;
+static unsigned long ctxgen; // last assigned context generation
+static unsigned long retiredcnt; // stats of the threads that have exited
+static unsigned long retiredsched;
+static long long retiredttotal;
+static unsigned long retiredichits;
+static unsigned long retiredicmisses;
+static _csstats retiredcs; // callstack counters of retired and recycled contexts
+static unsigned long evcounts[EVENT_TYPES]; // events handled by the hook by type
+static unsigned long evseq;
+static unsigned long evsampled; // events the hook has been timed on
+static long long cbtime; // ticks spent in the hook during the sampled events
+static unsigned long stackunderflows; // returns with an empty callstack
+static unsigned long ctxswitches;
 static int yappinitialized;
 static int yapphavestats;	// start() called at least once or stats cleared?
 static int yapprunning;
@@ -89,23 +255,83 @@ _create_pit(void)
     pit = flget(flpit);
     if (!pit)
         return NULL;
+    pit->id = ++pitcount;
     pit->callcount = 0;
     pit->ttotal = 0;
     pit->tsubtotal = 0;
     pit->co = NULL;
     pit->builtin = 0;
+    pit->hist = NULL;
+    pit->slow_threshold = -1;
+    pit->shm = NULL;
+    pit->lines = NULL;
+    pit->resumes = 0;
+    pit->nlife = 0;
+    pit->tlife = 0;
+    pit->ncold = 0;
+    pit->nentered = 0;
+    pit->tfirst = 0;
+    pit->tcold = 0;
+    pit->nsteady = 0;
+    pit->tsteady = 0;
+    pit->tag = newtag;
+    pit->ident = NULL;
+    pit->name = NULL;
 
     // we do not profile the fist time as if the first timing measures
     // can give incorrect calculations because of the caching behavior
     // of Python. This is because we multiply the flags.timing_sample
     // with the timing values of the function for the cold start. So just
     // do not measure time the first time unless timing sample is "1" of
-    // course.
+    // course. The first flags.cold_calls calls are timed apart anyway, see
+    // enum_cold_stats().
     pit->cpc = 0;
 
     return pit;
 }
 
+// returns an empty callstack, recycled from a retired context if possible.
+static _cstack *
+_get_cstack(void)
+{
+    if (cspoolcnt)
+        return cspool[--cspoolcnt];
+    return screate(100);
+}
+
+static void
+_htstats_add(_htstats *s, _htab *ht)
+{
+    s->lookups += ht->lookups;
+    s->probes += ht->probes;
+    s->grows += ht->grows;
+    s->growtime += ht->growtime;
+}
+
+static void
+_csstats_add(_csstats *s, _cstack *cs)
+{
+    _htstats_add(&s->counts, cs->_counts);
+    s->grows += cs->grows;
+}
+
+static void
+_put_cstack(_cstack *cs)
+{
+    _csstats_add(&retiredcs, cs);
+    if (cspoolcnt == CS_POOL_SIZE) {
+        sdestroy(cs);
+        return;
+    }
+    while (spop(cs))
+        ;
+    // the counters of the callstack are in retiredcs now.
+    cs->grows = 0;
+    cs->_counts->lookups = cs->_counts->probes = cs->_counts->grows = 0;
+    cs->_counts->growtime = 0;
+    cspool[cspoolcnt++] = cs;
+}
+
 static _ctx *
 _create_ctx(void)
 {
@@ -114,7 +340,7 @@ _create_ctx(void)
     ctx = flget(flctx);
     if (!ctx)
         return NULL;
-    ctx->cs = screate(100);
+    ctx->cs = _get_cstack();
     if (!ctx->cs)
         return NULL;
     ctx->last_pit = NULL;
@@ -122,34 +348,86 @@ _create_ctx(void)
     ctx->ttotal = 0;
     ctx->id = 0;
     ctx->class_name = NULL;
+    ctx->trace = NULL;
+    ctx->evq = NULL;
+    ctx->shm = NULL;
+    ctx->gen = ++ctxgen;
+    ctx->ichits = 0;
+    ctx->icmisses = 0;
+    memset(ctx->icache, 0, sizeof(ctx->icache));
+    ctx->lndepth = 0;
+    ctx->seeded = 0;
+    ctx->tag = NULL;
+    ctx->task = 0;
     return ctx;
 }
 
 
-// extracts the function name from a given pit. Note that pit->co may be
-// either a PyCodeObject or a descriptive string.
+// appends the tag of the pit to name as "name [tag]". Steals the reference
+// to name, returns a new one.
+static PyObject *
+_add_tag(PyObject *name, _pit *pt)
+{
+    PyObject *s, *r;
+
+    if (!name || !pt->tag)
+        return name;
+    r = NULL;
+    s = PyObject_Str(pt->tag->name);
+    if (s)
+        r = PyString_FromFormat("%s [%s]", PyString_AS_STRING(name), PyString_AS_STRING(s));
+    Py_XDECREF(s);
+    Py_DECREF(name);
+    return r;
+}
+
+// returns the name of the function of the pit, without its tag. Note that
+// pit->co may be either a PyCodeObject or a descriptive string.
+static PyObject *
+_pit_fname(_pit *pt)
+{
+    if (PyCode_Check(pt->co)) {
+        return PyString_FromFormat("%s.%s:%d",
+                                   PyString_AS_STRING(((PyCodeObject *)pt->co)->co_filename),
+                                   PyString_AS_STRING(((PyCodeObject *)pt->co)->co_name),
+                                   ((PyCodeObject *)pt->co)->co_firstlineno);
+    }
+    Py_INCREF(pt->co);
+    return pt->co;
+}
+
+// returns the display name of the pit, the tag of a tagged pit included.
+// The name is formatted once and owned by the pit, so polling stats does
+// not build it again.
+static PyObject *
+_pit_name(_pit *pt)
+{
+    if (pt->name)
+        return pt->name;
+
+    pt->name = _add_tag(_pit_fname(pt), pt);
+    if (!pt->name) {
+        PyErr_Clear();
+        return NULL;
+    }
+    if (PyCode_Check(pt->co) || pt->tag)
+        PyString_InternInPlace(&pt->name);
+    return pt->name;
+}
+
+// extracts the function name from a given pit. The returned buffer lives
+// as long as the pit.
 static char *
 _item2fname(_pit *pt)
 {
-    char *buf;
-    PyObject *fname;
+    PyObject *name;
 
     if (!pt)
         return NULL;
-
-    if (PyCode_Check(pt->co)) {
-        fname =  PyString_FromFormat( "%s.%s:%d",
-                                      PyString_AS_STRING(((PyCodeObject *)pt->co)->co_filename),
-                                      PyString_AS_STRING(((PyCodeObject *)pt->co)->co_name),
-                                      ((PyCodeObject *)pt->co)->co_firstlineno );
-    } else {
-        fname = pt->co;
-    }
-    buf = PyString_AS_STRING(fname); // TODO:memleak on buf?
-    if (PyCode_Check(pt->co)) {
-        Py_DECREF(fname);
-    }
-    return buf;
+    name = _pit_name(pt);
+    if (!name)
+        return NULL;
+    return PyString_AS_STRING(name);
 }
 
 char *
@@ -201,186 +479,790 @@ _del_pit(_pit *pit)
     // if it is a regular C string all DECREF will do is to decrement the first
     // character's value.
     Py_DECREF(pit->co);
+    Py_XDECREF(pit->ident);
+    Py_XDECREF(pit->name);
+    if (pit->hist)
+        histdestroy(pit->hist);
+    if (pit->lines)
+        yfree(pit->lines);
+}
+
+// returns a descriptive string for the given C function.
+static PyObject *
+_ccode2name(PyCFunctionObject *cfn)
+{
+    // built-in function?
+    if (cfn->m_self == NULL) {
+
+        PyObject *mod = cfn->m_module;
+        char *modname;
+
+        if (mod && PyString_Check(mod)) {
+            modname = PyString_AS_STRING(mod);
+        } else if (mod && PyModule_Check(mod)) {
+            modname = PyModule_GetName(mod);
+            if (modname == NULL) {
+                PyErr_Clear();
+                modname = "__builtin__";
+            }
+        } else {
+            modname = "__builtin__";
+        }
+        if (strcmp(modname, "__builtin__") != 0)
+            return PyString_FromFormat("<%s.%s>",
+                                       modname,
+                                       cfn->m_ml->ml_name);
+        else
+            return PyString_FromFormat("<%s>",
+                                       cfn->m_ml->ml_name);
+
+    } else { // built-in method?
+        PyObject *self = cfn->m_self;
+        PyObject *name = PyString_FromString(cfn->m_ml->ml_name);
+        if (name != NULL) {
+            PyObject *mo = _PyType_Lookup((PyTypeObject *)PyObject_Type(self), name);
+            Py_XINCREF(mo);
+            Py_DECREF(name);
+            if (mo != NULL) {
+                PyObject *res = PyObject_Repr(mo);
+                Py_DECREF(mo);
+                if (res != NULL) {
+                    return res;
+                }
+            }
+        }
+        PyErr_Clear();
+        return PyString_FromFormat("<built-in method %s>",
+                                   cfn->m_ml->ml_name);
+    }
+}
+
+// returns the value of the pit in the given dict of function names or NULL.
+// A pit is found either by the name the stats show or, for a Python
+// function, by its bare function name. Returns a borrowed reference.
+static PyObject *
+_pit_lookup(_pit *pt, PyObject *names)
+{
+    PyObject *fname, *r;
+
+    if (!pt->co)
+        return NULL;
+
+    // the names are given without the tag.
+    fname = pt->tag ? _pit_fname(pt) : _pit_name(pt);
+    if (!fname) {
+        PyErr_Clear();
+        return NULL;
+    }
+    r = PyDict_GetItem(names, fname);
+    if (pt->tag)
+        Py_DECREF(fname);
+    if (!r && PyCode_Check(pt->co))
+        r = PyDict_GetItem(names, ((PyCodeObject *)pt->co)->co_name);
+    return r;
+}
+
+// fills the given dict with the function names in seq, each mapped to val.
+static int
+_names2dict(PyObject *dict, PyObject *seq, PyObject *val)
+{
+    int i;
+    PyObject *names;
+
+    if (PyString_Check(seq))
+        return PyDict_SetItem(dict, seq, val);
+
+    names = PySequence_Fast(seq, "function names must be a list.");
+    if (!names)
+        return -1;
+    for(i=0; i<PySequence_Fast_GET_SIZE(names); i++) {
+        PyObject *name = PySequence_Fast_GET_ITEM(names, i);
+        if (!PyString_Check(name)) {
+            PyErr_SetString(YappiProfileError, "function names must be strings.");
+            Py_DECREF(names);
+            return -1;
+        }
+        if (PyDict_SetItem(dict, name, val) < 0) {
+            Py_DECREF(names);
+            return -1;
+        }
+    }
+    Py_DECREF(names);
+    return 0;
+}
+
+// returns the identity of the pit as filename:name:line for Python functions
+// and the descriptive string for builtins, followed by " [tag]" if tagged.
+static PyObject *
+_pit2ident(_pit *pt)
+{
+    PyCodeObject *co;
+
+    if (!pt->co)
+        return NULL;
+    if (PyCode_Check(pt->co)) {
+        co = (PyCodeObject *)pt->co;
+        return _add_tag(PyString_FromFormat("%s:%s:%d", PyString_AS_STRING(co->co_filename),
+                                            PyString_AS_STRING(co->co_name), co->co_firstlineno),
+                        pt);
+    }
+    Py_INCREF(pt->co);
+    return _add_tag(pt->co, pt);
+}
+
+// writes the id of the pit and its name to the names file of the trace.
+static void
+_trace_name(_pit *pit)
+{
+    char *fname;
+
+    fname = _item2fname(pit);
+    if (!fname)
+        fname = "N/A";
+    fprintf(tracenames, "%u\t%s\n", pit->id, fname);
+    // the records are in a mapped file and survive a crash, the names must
+    // too.
+    fflush(tracenames);
+}
+
+// adds the shared memory record of the pit.
+static void
+_shm_addpit(_pit *pit)
+{
+    PyObject *name;
+
+    name = _pit2ident(pit);
+    if (!name) {
+        PyErr_Clear();
+        return;
+    }
+    pit->shm = shmaddpit(shm, PyString_AS_STRING(name), pit->builtin);
+    Py_DECREF(name);
+    if (pit->shm)
+        shmupdpit(pit->shm, pit->callcount, pit->ttotal, pit->tsubtotal);
+}
+
+// returns empty line stats spanning the lines of the code.
+static _lineprof *
+_create_lineprof(PyCodeObject *co)
+{
+    int i, n, line, last;
+    unsigned char *p;
+    _lineprof *lp;
+
+    // the last line is found by walking the line number table.
+    line = last = co->co_firstlineno;
+    p = (unsigned char *)PyString_AS_STRING(co->co_lnotab);
+    n = PyString_GET_SIZE(co->co_lnotab) / 2;
+    for(i=0; i<n; i++) {
+        line += p[2*i+1];
+        if (line > last)
+            last = line;
+    }
+
+    lp = ytmalloc(sizeof(_lineprof) + (last - co->co_firstlineno) * sizeof(_linestat),
+                  YMEM_PIT);
+    if (!lp)
+        return NULL;
+    lp->first = co->co_firstlineno;
+    lp->count = last - lp->first + 1;
+    memset(lp->lines, 0, lp->count * sizeof(_linestat));
+    return lp;
+}
+
+// called once the pit is named. attaches the optional per-pit data
+// selected in yappi.start(). co is the code the pit is created for, NULL
+// for C functions.
+static void
+_init_pit_opts(_pit *pit, PyCodeObject *co)
+{
+    PyObject *v;
+
+    if (tracenames)
+        _trace_name(pit);
+    if (shm)
+        _shm_addpit(pit);
+
+    if (flags.latency_hist && (!histfilter || _pit_lookup(pit, histfilter)) &&
+            (!maxmem || ymemusage() + sizeof(_hist) <= maxmem)) {
+        pit->hist = histcreate();
+        if (!pit->hist)
+            yerr("latency histogram cannot be allocated.");
+    }
+    if (slowfilter) {
+        v = _pit_lookup(pit, slowfilter);
+        if (v)
+            pit->slow_threshold = PyLong_AsLongLong(v);
+    }
+    if (linefilter && co && _pit_lookup(pit, linefilter) &&
+            (!maxmem || ymemusage() < maxmem)) {
+        pit->lines = _create_lineprof(co);
+        if (!pit->lines)
+            yerr("line stats cannot be allocated.");
+    }
+}
+
+// returns the pit that the calls of new functions are folded into once the
+// memory budget is reached.
+static _pit *
+_other_pit(void)
+{
+    PyObject *co;
+    _pit *pit;
+
+    if (otherpit)
+        return otherpit;
+
+    co = PyString_FromString("<other>");
+    if (!co)
+        return NULL;
+    pit = _create_pit();
+    if (!pit || !hadd(pits, (uintptr_t)&otherpit, (uintptr_t)pit)) {
+        Py_DECREF(co);
+        return NULL;
+    }
+    pit->co = co;
+    pit->tag = NULL; // shared by all tags
+    _init_pit_opts(pit, NULL);
+    otherpit = pit;
+    return pit;
 }
 
 static _pit *
-_ccode2pit(void *cco)
+_ccode2pit(_htab *tab, void *cco)
 {
     PyCFunctionObject *cfn;
     _hitem *it;
+    _pit *pit;
 
     cfn = cco;
     // Issue #15:
     // Hashing cfn to the pits table causes different object methods
     // to be hashed into the same slot. Use cfn->m_ml for hashing the
     // Python C functions.
-    it = hfind(pits, (uintptr_t)cfn->m_ml);
+    it = hfind(tab, (uintptr_t)cfn->m_ml);
     if (!it) {
-        _pit *pit = _create_pit();
+        if (maxmem && ymemusage() >= maxmem)
+            return _other_pit();
+        pit = _create_pit();
         if (!pit)
             return NULL;
-        if (!hadd(pits, (uintptr_t)cfn->m_ml, (uintptr_t)pit))
+        if (!hadd(tab, (uintptr_t)cfn->m_ml, (uintptr_t)pit))
             return NULL;
 
         pit->builtin = 1; // set the bultin here
+        pit->co = _ccode2name(cfn);
+        _init_pit_opts(pit, NULL);
+        return pit;
+    }
+    return ((_pit *)it->val);
+}
 
-        // built-in function?
-        if (cfn->m_self == NULL) {
+static int
+_ctxenumicdrop(_hitem *item, void *arg)
+{
+    _icentry *e;
 
-            PyObject *mod = cfn->m_module;
-            char *modname;
+    e = &((_ctx *)item->val)->icache[ICACHE_SLOT(arg)];
+    if (e->key == arg)
+        e->key = NULL;
+    return 0;
+}
 
+// weakref callback of a code object in dedup mode, key is its address.
+static PyObject *
+_code_dead(PyObject *key, PyObject *ref)
+{
+    _hitem *it;
 
+    it = hfind(codes, (uintptr_t)PyLong_AsVoidPtr(key));
+    if (it)
+        hfree(codes, it);
+    // the address may be reused by another code object.
+    henum(contexts, _ctxenumicdrop, PyLong_AsVoidPtr(key));
+    if (PyDict_DelItem(coderefs, key) < 0)
+        PyErr_Clear();
 
-            if (mod && PyString_Check(mod)) {
-                modname = PyString_AS_STRING(mod);
-            } else if (mod && PyModule_Check(mod)) {
-                modname = PyModule_GetName(mod);
-                if (modname == NULL) {
-                    PyErr_Clear();
-                    modname = "__builtin__";
-                }
-            } else {
-                modname = "__builtin__";
-            }
-            if (strcmp(modname, "__builtin__") != 0)
-                pit->co = PyString_FromFormat("<%s.%s>",
-                                              modname,
-                                              cfn->m_ml->ml_name);
-            else
-                pit->co = PyString_FromFormat("<%s>",
-                                              cfn->m_ml->ml_name);
-
-        } else { // built-in method?
-            PyObject *self = cfn->m_self;
-            PyObject *name = PyString_FromString(cfn->m_ml->ml_name);
-            if (name != NULL) {
-                PyObject *mo = _PyType_Lookup((PyTypeObject *)PyObject_Type(self), name);
-                Py_XINCREF(mo);
-                Py_DECREF(name);
-                if (mo != NULL) {
-                    PyObject *res = PyObject_Repr(mo);
-                    Py_DECREF(mo);
-                    if (res != NULL) {
-                        pit->co = res;
-                        return pit;
-                    }
-                }
-            }
-            PyErr_Clear();
-            pit->co = PyString_FromFormat("<built-in method %s>",
-                                          cfn->m_ml->ml_name);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef _code_dead_def = {"_code_dead", (PyCFunction)_code_dead, METH_O, NULL};
+
+// remembers the pit of the code object until the code dies, without
+// keeping it alive. With a NULL pit the code is only watched, so that the
+// pit caches drop it when it dies.
+static void
+_watch_code(PyCodeObject *co, _pit *pit)
+{
+    PyObject *key, *cb, *ref;
+
+    ref = cb = NULL;
+    key = PyLong_FromVoidPtr(co);
+    if (key && !pit && PyDict_GetItem(coderefs, key)) {
+        Py_DECREF(key);
+        return;
+    }
+    if (key)
+        cb = PyCFunction_New(&_code_dead_def, key);
+    if (cb)
+        ref = PyWeakref_NewRef((PyObject *)co, cb);
+    if (ref && PyDict_SetItem(coderefs, key, ref) == 0) {
+        if (pit && !hadd(codes, (uintptr_t)co, (uintptr_t)pit))
+            PyDict_DelItem(coderefs, key);
+    }
+    PyErr_Clear(); // the code is looked up by its identity again next time.
+    Py_XDECREF(ref);
+    Py_XDECREF(cb);
+    Py_XDECREF(key);
+}
+
+// dedup mode: pits are keyed by the interned filename:name:line identity of
+// the code, so code objects generated again and again share a single pit.
+// The pit holds an empty code object with the same identity instead of the
+// code itself.
+static _pit *
+_ident2pit(_htab *tab, PyCodeObject *co)
+{
+    PyObject *ident;
+    PyCodeObject *eco;
+    _hitem *it;
+    _pit *pit;
+
+    ident = PyString_FromFormat("%s:%s:%d", PyString_AS_STRING(co->co_filename),
+                                PyString_AS_STRING(co->co_name), co->co_firstlineno);
+    if (!ident)
+        return NULL;
+    PyString_InternInPlace(&ident);
+
+    it = hfind(tab, (uintptr_t)ident);
+    if (it) {
+        Py_DECREF(ident);
+        pit = (_pit *)it->val;
+    } else {
+        if (maxmem && ymemusage() >= maxmem) {
+            Py_DECREF(ident);
+            return _other_pit();
         }
-        return pit;
+        eco = PyCode_NewEmpty(PyString_AS_STRING(co->co_filename),
+                              PyString_AS_STRING(co->co_name), co->co_firstlineno);
+        if (!eco) {
+            Py_DECREF(ident);
+            return NULL;
+        }
+        pit = _create_pit();
+        if (!pit || !hadd(tab, (uintptr_t)ident, (uintptr_t)pit)) {
+            Py_DECREF(eco);
+            Py_DECREF(ident);
+            return NULL;
+        }
+        pit->co = (PyObject *)eco;
+        pit->ident = ident;
+        _init_pit_opts(pit, co);
     }
-    return ((_pit *)it->val);
+    // the code -> pit shortcut is only kept for the untagged pits, the code
+    // of a tagged one is still watched for the pit caches.
+    _watch_code(co, (tab == pits) ? pit : NULL);
+    return pit;
 }
 
-// maps the PyCodeObject to our internal pit item via hash table.
+// maps the PyCodeObject to our internal pit item via hash table. tab is
+// the pits table or the one of a tag.
 static _pit *
-_code2pit(void *co)
+_code2pit(_htab *tab, void *co)
 {
     _hitem *it;
+    _pit *pit;
+
+    if (flags.dedup) {
+        it = (tab == pits) ? hfind(codes, (uintptr_t)co) : NULL;
+        if (it)
+            return (_pit *)it->val;
+        return _ident2pit(tab, (PyCodeObject *)co);
+    }
 
-    it = hfind(pits, (uintptr_t)co);
+    it = hfind(tab, (uintptr_t)co);
     if (!it) {
-        _pit *pit = _create_pit();
+        if (maxmem && ymemusage() >= maxmem)
+            return _other_pit();
+        pit = _create_pit();
         if (!pit)
             return NULL;
-        if (!hadd(pits, (uintptr_t)co, (uintptr_t)pit))
+        if (!hadd(tab, (uintptr_t)co, (uintptr_t)pit))
             return NULL;
         Py_INCREF((PyObject *)co);
         pit->co = co; //dummy
+        _init_pit_opts(pit, (PyCodeObject *)co);
         return pit;
     }
     return ((_pit *)it->val);
 }
 
-static void
-_call_enter(PyObject *self, PyFrameObject *frame, PyObject *arg, int ccall)
+// returns the pit of the function for calls made under the tag. The pits
+// of tags are also added to the pits table, keyed by their own address, so
+// they are listed, dumped and freed with the others.
+static _pit *
+_tag2pit(_tag *tag, void *obj, int ccall)
 {
-    _pit *cp;
-    PyObject *last_type, *last_value, *last_tb;
-    _cstackitem *hci;
+    _pit *pit;
+    unsigned int last;
+
+    // the tag is set when the pit is created, its name and options
+    // depend on it.
+    last = pitcount;
+    newtag = tag;
+    if (ccall)
+        pit = _ccode2pit(tag->pits, obj);
+    else
+        pit = _code2pit(tag->pits, obj);
+    newtag = NULL;
+    if (!pit || pit == otherpit || pit->id <= last)
+        return pit;
+    if (!hadd(pits, (uintptr_t)pit, (uintptr_t)pit))
+        yerr("tagged pit cannot be added. Possible memory leak.");
+    return pit;
+}
 
-    PyErr_Fetch(&last_type, &last_value, &last_tb);
+// returns the pit of the called code object or C function (obj) through
+// the cache of the current context. key is what the pits table is keyed
+// by.
+static _pit *
+_icache_pit(void *key, void *obj, int ccall)
+{
+    _icentry *e;
+    _pit *pit;
 
-    if (ccall) {
-        cp = _ccode2pit((PyCFunctionObject *)arg);
-    } else {
-        cp = _code2pit(frame->f_code);
+    e = &current_ctx->icache[ICACHE_SLOT(key)];
+    if (e->key == key) {
+        current_ctx->ichits++;
+        return e->pit;
     }
-
-    // something went wrong. No mem, or another error. we cannot find
-    // a corresponding pit. just run away:)
-    if (!cp) {
-        yerr("pit not found");
-        goto err;
+    current_ctx->icmisses++;
+
+    if (current_ctx->tag)
+        pit = _tag2pit(current_ctx->tag, obj, ccall);
+    else if (ccall)
+        pit = _ccode2pit(pits, obj);
+    else
+        pit = _code2pit(pits, obj);
+    // <other> holds no reference to the code, its address may be reused.
+    if (pit && pit != otherpit) {
+        e->key = key;
+        e->pit = pit;
     }
+    return pit;
+}
 
-    hci = spush(current_ctx->cs, cp);
+// pushes the called pit to the callstack of the context. t is the time of
+// the call or 0 to read the clock only if the call is sampled. A resumed
+// generator is on the callstack while it runs but is not a new call.
+// Returns the pushed item, NULL if the callstack cannot grow.
+static _cstackitem *
+_pit_enter(_ctx *ctx, _pit *cp, long long t, int resume)
+{
+    _cstackitem *hci;
+
+    hci = spush(ctx->cs, cp);
     if (!hci) { // runaway!
         yerr("spush failed.");
-        goto err;
+        return NULL;
     }
 
-    // do not do timing measures until timing_sample is reached.
-    if (++cp->cpc >= flags.timing_sample) {
-        hci->t0 = tickcount();
+    // do not do timing measures until timing_sample is reached. The first
+    // calls are always timed.
+    hci->cold = !resume && cp->nentered < (unsigned int)flags.cold_calls;
+    if (hci->cold)
+        cp->nentered++;
+    if (++cp->cpc >= flags.timing_sample || hci->cold) {
+        hci->t0 = t ? t : tickcount();
     }
 
-    cp->callcount++;
+    if (!resume) {
+        cp->callcount++;
+        // counted here and not by _other_pit(), which also runs on returns.
+        if (cp == otherpit)
+            foldedcalls++;
+    }
 
     // do not show builtin pits if specified even in last_pit of the context.
     if  ((!flags.builtins) && (cp->builtin))
         ;
     else {
-        current_ctx->last_pit = cp;
+        ctx->last_pit = cp;
     }
+    return hci;
+}
 
-    PyErr_Restore(last_type, last_value, last_tb);
-
-err:
-
-    PyErr_Restore(last_type, last_value, last_tb);
+// the trace function of a thread while it runs a line profiled function.
+// The time of a line lasts until the next line of the same frame starts.
+static int
+_yapp_line_callback(PyObject *self, PyFrameObject *frame, int what,
+                    PyObject *arg)
+{
+    int line;
+    long long t;
+    _ctx *ctx;
+    _lnframe *lf;
+    _lineprof *lp;
+
+    ctx = yappinitialized ? _thread2ctx(frame->f_tstate) : NULL;
+    if (!ctx || !ctx->lndepth) {
+        // the thread was unprofiled by another one, which cannot untrace it
+        // through the API. It is untraced here, on its own next event.
+        PyEval_SetTrace(NULL, NULL);
+        return 0;
+    }
+    if (what != PyTrace_LINE || ctx->lndepth > LINE_STACK_DEPTH)
+        return 0;
+    lf = &ctx->lnstack[ctx->lndepth-1];
+    if (lf->frame != frame) // a line of a function called from the profiled one
+        return 0;
 
+    t = tickcount();
+    lp = lf->pit->lines;
+    if (lf->line >= 0)
+        lp->lines[lf->line].ttotal += t - lf->t;
+    line = frame->f_lineno - lp->first;
+    lf->line = (line >= 0 && line < lp->count) ? line : -1;
+    if (lf->line >= 0)
+        lp->lines[lf->line].hits++;
+    lf->t = t;
+    return 0;
 }
 
+// a line profiled function is called. Line events are only enabled while
+// such a function runs on the thread, and only if no one else traces it.
+static void
+_line_enter(_ctx *ctx, PyFrameObject *frame, _pit *cp)
+{
+    _lnframe *lf;
+
+    if (!ctx->lndepth && !frame->f_tstate->c_tracefunc)
+        PyEval_SetTrace(_yapp_line_callback, NULL);
+    if (ctx->lndepth < LINE_STACK_DEPTH) {
+        lf = &ctx->lnstack[ctx->lndepth];
+        lf->frame = frame;
+        lf->pit = cp;
+        lf->line = -1;
+        lf->t = 0;
+    }
+    ctx->lndepth++;
+}
 
 static void
-_call_leave(PyObject *self, PyFrameObject *frame, PyObject *arg)
+_line_leave(_ctx *ctx, PyFrameObject *frame)
 {
-    _pit *cp, *pp;
-    _cstackitem *ci,*pi;
-    long long elapsed;
+    _lnframe *lf;
+
+    if (ctx->lndepth <= LINE_STACK_DEPTH) {
+        lf = &ctx->lnstack[ctx->lndepth-1];
+        if (lf->frame != frame)
+            return;
+        if (lf->line >= 0)
+            lf->pit->lines->lines[lf->line].ttotal += tickcount() - lf->t;
+    }
+    ctx->lndepth--;
+    if (!ctx->lndepth && frame->f_tstate->c_tracefunc == _yapp_line_callback)
+        PyEval_SetTrace(NULL, NULL);
+}
 
-    ci = spop(current_ctx->cs);
-    if (!ci) {
-        return; // leaving a frame while callstack is empty
+// a generator frame is entered. Returns 1 if it is resumed, otherwise a
+// new generator call starts and its lifetime is tracked until it finishes.
+static int
+_gen_enter(PyFrameObject *frame, _pit *cp)
+{
+    _hitem *it;
+    _gen *g;
+
+    // a generator started before the profiler is counted as a new call
+    // the first time it is resumed, like the frames seeded at start.
+    it = hfind(gens, (uintptr_t)frame);
+    if (frame->f_lasti != -1 && it) {
+        cp->resumes++;
+        return 1;
     }
-    cp = ci->ckey;
 
-    // timing sample reached?
-    if (cp->cpc < flags.timing_sample) {
-        return;
+    // the frame of a dead generator may be reused by a new one.
+    if (it) {
+        g = (_gen *)it->val;
+    } else {
+        g = flget(flgen);
+        if (!g)
+            return 0;
+        if (!hadd(gens, (uintptr_t)frame, (uintptr_t)g)) {
+            flput(flgen, g);
+            return 0;
+        }
     }
+    g->tstart = tickcount();
+    g->pit = cp;
+    return 0;
+}
 
-    elapsed = tickcount() - ci->t0;
+// a generator frame returns. A yield leaves the value stack of the frame
+// in place, the generator only finishes if it has none.
+static void
+_gen_leave(PyFrameObject *frame)
+{
+    _hitem *it;
+    _gen *g;
+
+    if (frame->f_stacktop)
+        return;
+    it = hfind(gens, (uintptr_t)frame);
+    if (!it)
+        return; // started before the profiler
+    g = (_gen *)it->val;
+    g->pit->tlife += tickcount() - g->tstart;
+    g->pit->nlife++;
+    hfree(gens, it);
+    flput(flgen, g);
+}
+
+static void
+_call_enter(PyObject *self, PyFrameObject *frame, PyObject *arg, int ccall)
+{
+    int resume;
+    _pit *cp;
+    PyObject *last_type, *last_value, *last_tb;
+
+    PyErr_Fetch(&last_type, &last_value, &last_tb);
+
+    if (ccall) {
+        cp = _icache_pit(((PyCFunctionObject *)arg)->m_ml, arg, 1);
+    } else {
+        cp = _icache_pit(frame->f_code, frame->f_code, 0);
+    }
+
+    // something went wrong. No mem, or another error. we cannot find
+    // a corresponding pit. just run away:)
+    if (!cp) {
+        yerr("pit not found");
+        goto err;
+    }
+
+    resume = 0;
+    if (!ccall && (frame->f_code->co_flags & CO_GENERATOR))
+        resume = _gen_enter(frame, cp);
+    _pit_enter(current_ctx, cp, 0, resume);
+    if (cp->lines)
+        _line_enter(current_ctx, frame, cp);
+
+err:
+
+    PyErr_Restore(last_type, last_value, last_tb);
+
+}
+
+
+// records the callstack of a call that took longer than the slow call
+// threshold. The popped item of the call is not on the callstack anymore.
+static void
+_log_slow_call(_ctx *ctx, _pit *cp, _cstackitem *ci, long long elapsed)
+{
+    int i, first;
+    _slowcall *sc;
+
+    sc = (_slowcall *)rpush(slowcalls);
+    sc->tid = ctx->id;
+    sc->tstart = yappstarttime + (ci->t0 - yappstarttick) * tickfactor();
+    sc->elapsed = elapsed;
+    sc->depth = slen(ctx->cs) + 1;
+
+    // keep the innermost frames if the callstack is too deep.
+    first = sc->depth - SLOW_STACK_DEPTH;
+    if (first < 0)
+        first = 0;
+    sc->nframes = 0;
+    for(i=first; i<sc->depth-1; i++)
+        sc->frames[sc->nframes++] = ctx->cs->_items[i].ckey;
+    sc->frames[sc->nframes++] = cp;
+}
+
+// mirrors the counters changed by a return to the shared memory records.
+static void
+_shm_sync(_ctx *ctx, _pit *cp, _pit *pp)
+{
+    if (cp->shm)
+        shmupdpit(cp->shm, cp->callcount, cp->ttotal, cp->tsubtotal);
+    if (pp && pp->shm)
+        shmupdpit(pp->shm, pp->callcount, pp->ttotal, pp->tsubtotal);
+    if (ctx->shm)
+        shmupdctx(ctx->shm, ctx->sched_cnt, ctx->ttotal);
+}
+
+// pops the returning pit from the callstack of the context and does the
+// accounting. t is the time of the return or 0 to read the clock.
+static void
+_pit_leave(_ctx *ctx, long long t, int ccall)
+{
+    _pit *cp, *pp;
+    _cstackitem *ci,*pi;
+    long long elapsed, threshold;
+
+    // a C function that was running when the callstack was seeded has no
+    // item on it, its return must not pop the frame that called it.
+    if (ccall && slen(ctx->cs) <= ctx->seeded) {
+        stackunderflows++;
+        return;
+    }
+
+    ci = spop(ctx->cs);
+    if (!ci) {
+        stackunderflows++;
+        return; // leaving a frame while callstack is empty
+    }
+    cp = ci->ckey;
+    if (ctx->seeded > slen(ctx->cs))
+        ctx->seeded = slen(ctx->cs);
+
+    if (ci->cold) {
+        if (!t)
+            t = tickcount();
+        elapsed = t - ci->t0;
+        if (!cp->ncold)
+            cp->tfirst = elapsed;
+        cp->ncold++;
+        if (scount(ctx->cs, cp) <= 0)
+            cp->tcold += elapsed;
+    }
+
+    // timing sample reached?
+    if (cp->cpc < flags.timing_sample) {
+        return;
+    }
+
+    elapsed = (t ? t : tickcount()) - ci->t0;
     cp->cpc = 0;
 
+    if (cp->hist)
+        histadd(cp->hist, elapsed);
+
+    if (!ci->cold) {
+        cp->nsteady++;
+        if (scount(ctx->cs, cp) <= 0)
+            cp->tsteady += elapsed;
+    }
+
+    threshold = (cp->slow_threshold >= 0) ? cp->slow_threshold : slow_threshold;
+    if (threshold && elapsed >= threshold)
+        _log_slow_call(ctx, cp, ci, elapsed);
+
     // get the parent function in the callstack
-    pi = shead(current_ctx->cs);
+    pi = shead(ctx->cs);
     if (!pi) { // no head this is the first function in the callstack?
         cp->ttotal += elapsed;
+        if (shm)
+            _shm_sync(ctx, cp, NULL);
         return;
     }
     pp = pi->ckey;
 
     // are we leaving a recursive function that is already in the callstack?
     // then extract the elapsed from subtotal of the the current pit(profile item).
-    if (scount(current_ctx->cs, cp) > 0) {
+    if (scount(ctx->cs, cp) > 0) {
         cp->tsubtotal -= elapsed;
-        current_ctx->ttotal -= elapsed;
+        ctx->ttotal -= elapsed;
     } else {
         cp->ttotal += elapsed;
     }
@@ -389,7 +1271,23 @@ _call_leave(PyObject *self, PyFrameObject *frame, PyObject *arg)
     // below code will have no effect.
     pp->tsubtotal += elapsed;
 
-    current_ctx->ttotal += elapsed;
+    ctx->ttotal += elapsed;
+
+    if (shm)
+        _shm_sync(ctx, cp, pp);
+}
+
+static void
+_call_leave(PyObject *self, PyFrameObject *frame, PyObject *arg, int ccall)
+{
+    _cstackitem *ci;
+
+    if (current_ctx->lndepth) {
+        ci = shead(current_ctx->cs);
+        if (ci && ((_pit *)ci->ckey)->lines)
+            _line_leave(current_ctx, frame);
+    }
+    _pit_leave(current_ctx, 0, ccall);
 }
 
 // context will be cleared by the free list. we do not free it here.
@@ -397,26 +1295,314 @@ _call_leave(PyObject *self, PyFrameObject *frame, PyObject *arg)
 static void
 _del_ctx(_ctx * ctx)
 {
-    sdestroy(ctx->cs);
+    _put_cstack(ctx->cs);
+    if (ctx->trace)
+        trdestroy(ctx->trace);
+    if (ctx->evq)
+        qdestroy(ctx->evq);
+}
+
+// does the accounting of the queued events of the context. The caller
+// holds agglock.
+static void
+_drain_queue(_ctx *ctx)
+{
+    _defevent *e;
+
+    while ((e = qpeek(ctx->evq))) {
+        if (e->pit)
+            _pit_enter(ctx, e->pit, e->t, e->resume);
+        else
+            _pit_leave(ctx, e->t, e->ccall);
+        qpop(ctx->evq);
+    }
+}
+
+static int
+_ctxenumdrain(_hitem *item, void *arg)
+{
+    _ctx *ctx;
+
+    ctx = (_ctx *)item->val;
+    if (ctx->evq)
+        _drain_queue(ctx);
+    return 0;
+}
+
+// the aggregator thread. It does not need the GIL, the contexts table is
+// only modified while holding agglock in deferred mode.
+static void
+_aggregator(void *arg)
+{
+    while (aggrunning) {
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+        henum(contexts, _ctxenumdrain, NULL);
+        PyThread_release_lock(agglock);
+        ysleep(AGG_INTERVAL);
+    }
+    PyThread_release_lock(aggexit);
+}
+
+// makes the stats current in deferred mode.
+static void
+_flush_deferred(void)
+{
+    if (!flags.deferred)
+        return;
+    PyThread_acquire_lock(agglock, WAIT_LOCK);
+    henum(contexts, _ctxenumdrain, NULL);
+    PyThread_release_lock(agglock);
+}
+
+// deferred mode: the event is only queued for the aggregator thread, which
+// does the accounting off the hook.
+static void
+_defer_event(PyFrameObject *frame, int what, PyObject *arg)
+{
+    int resume, ccall;
+    _pit *cp;
+    _defevent *e;
+    PyObject *last_type, *last_value, *last_tb;
+
+    if (!current_ctx->evq)
+        return;
+
+    cp = NULL;
+    resume = ccall = 0;
+    switch (what) {
+    case PyTrace_CALL:
+        PyErr_Fetch(&last_type, &last_value, &last_tb);
+        cp = _icache_pit(frame->f_code, frame->f_code, 0);
+        PyErr_Restore(last_type, last_value, last_tb);
+        if (!cp) {
+            yerr("pit not found");
+            return;
+        }
+        if (frame->f_code->co_flags & CO_GENERATOR)
+            resume = _gen_enter(frame, cp);
+        break;
+    case PyTrace_RETURN:
+        if (frame->f_code->co_flags & CO_GENERATOR)
+            _gen_leave(frame);
+        break;
+#ifdef PyTrace_C_CALL
+    case PyTrace_C_CALL:
+        if (!PyCFunction_Check(arg))
+            return;
+        PyErr_Fetch(&last_type, &last_value, &last_tb);
+        cp = _icache_pit(((PyCFunctionObject *)arg)->m_ml, arg, 1);
+        PyErr_Restore(last_type, last_value, last_tb);
+        if (!cp) {
+            yerr("pit not found");
+            return;
+        }
+        break;
+    case PyTrace_C_RETURN:
+    case PyTrace_C_EXCEPTION:
+        if (!PyCFunction_Check(arg))
+            return;
+        ccall = 1;
+        break;
+#endif
+    default:
+        return;
+    }
+
+    e = qslot(current_ctx->evq);
+    if (!e) {
+        // the aggregator falls behind, drain the queue of the thread here.
+        // It never waits for the GIL, so blocking with the GIL is safe.
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+        _drain_queue(current_ctx);
+        PyThread_release_lock(agglock);
+        e = qslot(current_ctx->evq);
+    }
+    e->pit = cp;
+    e->t = tickcount();
+    e->resume = resume;
+    e->ccall = ccall;
+    qpush(current_ctx->evq);
+}
+
+// trace mode: the event is only appended to the trace of the thread, no
+// stats are aggregated in the hook.
+static void
+_trace_event(PyFrameObject *frame, int what, PyObject *arg)
+{
+    _pit *cp;
+    unsigned int ev;
+    PyObject *last_type, *last_value, *last_tb;
+
+    if (!current_ctx->trace)
+        return;
+
+    PyErr_Fetch(&last_type, &last_value, &last_tb);
+
+    switch (what) {
+    case PyTrace_CALL:
+        cp = _icache_pit(frame->f_code, frame->f_code, 0);
+        ev = TRACE_CALL;
+        break;
+    case PyTrace_RETURN:
+        cp = _icache_pit(frame->f_code, frame->f_code, 0);
+        ev = TRACE_RETURN;
+        break;
+#ifdef PyTrace_C_CALL
+    case PyTrace_C_CALL:
+        if (!flags.builtins || !PyCFunction_Check(arg))
+            goto out;
+        cp = _icache_pit(((PyCFunctionObject *)arg)->m_ml, arg, 1);
+        ev = TRACE_CALL;
+        break;
+    case PyTrace_C_RETURN:
+    case PyTrace_C_EXCEPTION:
+        if (!flags.builtins || !PyCFunction_Check(arg))
+            goto out;
+        cp = _icache_pit(((PyCFunctionObject *)arg)->m_ml, arg, 1);
+        ev = TRACE_RETURN;
+        break;
+#endif
+    default:
+        goto out;
+    }
+
+    if (!cp) {
+        yerr("pit not found");
+        goto out;
+    }
+    tradd(current_ctx->trace, tickcount(), cp->id, ev);
+
+out:
+    PyErr_Restore(last_type, last_value, last_tb);
+}
+
+// adds the stats of a context that is done to the retired stats and
+// recycles it.
+static void
+_free_retired(_ctx *ctx)
+{
+    retiredcnt++;
+    retiredsched += ctx->sched_cnt;
+    retiredttotal += ctx->ttotal;
+    retiredichits += ctx->ichits;
+    retiredicmisses += ctx->icmisses;
+    if (current_ctx == ctx)
+        current_ctx = NULL;
+    if (prev_ctx == ctx)
+        prev_ctx = NULL;
+
+    _del_ctx(ctx);
+    if (!flput(flctx, ctx))
+        yerr("Context cannot be recycled. Possible memory leak.[%lu bytes]", (unsigned long)sizeof(_ctx));
+}
+
+// returns the context of the task the context id callback says is running,
+// NULL if the callback fails. Task contexts are also added to the contexts
+// table, keyed by their own address, so they are listed with the threads.
+static _ctx *
+_task2ctx(void)
+{
+    long id;
+    PyObject *r;
+    _hitem *it;
+    _ctx *ctx;
+    PyObject *last_type, *last_value, *last_tb;
+
+    if (ctxidfn) {
+        id = ctxidfn();
+    } else {
+        PyErr_Fetch(&last_type, &last_value, &last_tb);
+        r = PyObject_CallObject(ctxidcb, NULL);
+        id = r ? PyInt_AsLong(r) : -1;
+        Py_XDECREF(r);
+        if (id == -1 && PyErr_Occurred()) {
+            PyErr_Clear();
+            PyErr_Restore(last_type, last_value, last_tb);
+            return NULL;
+        }
+        PyErr_Restore(last_type, last_value, last_tb);
+    }
+
+    it = hfind(tasks, (uintptr_t)id);
+    if (it)
+        return (_ctx *)it->val;
+
+    ctx = _create_ctx();
+    if (!ctx)
+        return NULL;
+    ctx->id = id;
+    ctx->task = 1;
+    ctx->class_name = "Task"; // tasks come and go, do not ask threading each time.
+    if (!hadd(tasks, (uintptr_t)id, (uintptr_t)ctx))
+        goto err;
+    if (!hadd(contexts, (uintptr_t)ctx, (uintptr_t)ctx)) {
+        hfree(tasks, hfind(tasks, (uintptr_t)id));
+        goto err;
+    }
+    return ctx;
+
+err:
+    _del_ctx(ctx);
+    flput(flctx, ctx);
+    return NULL;
+}
+
+// a task is done once it has returned from all its frames. It is retired
+// when another context runs, a new task with the same id gets a new one.
+static void
+_retire_task(_ctx *ctx)
+{
+    _hitem *it;
+
+    it = hfind(tasks, (uintptr_t)ctx->id);
+    if (it && (_ctx *)it->val == ctx)
+        hfree(tasks, it);
+    it = hfind(contexts, (uintptr_t)ctx);
+    if (it)
+        hfree(contexts, it);
+    _free_retired(ctx);
 }
 
 static int
 _yapp_callback(PyObject *self, PyFrameObject *frame, int what,
                PyObject *arg)
 {
+    long long t0;
+
+    if ((unsigned int)what < EVENT_TYPES)
+        evcounts[what]++;
+    // the hook takes less than a tick on some platforms, timing a sample of
+    // the events keeps the cost low and the sum unbiased.
+    t0 = 0;
+    if (++evseq % SELF_TIMING_SAMPLE == 0)
+        t0 = tickcount();
+
     // get current ctx
-    current_ctx = _thread2ctx(frame->f_tstate);
+    current_ctx = ctxidcb ? _task2ctx() : NULL;
+    if (!current_ctx)
+        current_ctx = _thread2ctx(frame->f_tstate);
     if (!current_ctx) {
         yerr("context not found.");
         return 0;
     }
 
+    if (tracedir) {
+        _trace_event(frame, what, arg);
+        goto ctxstats;
+    }
+    if (flags.deferred) {
+        _defer_event(frame, what, arg);
+        goto ctxstats;
+    }
+
     switch (what) {
     case PyTrace_CALL:
         _call_enter(self, frame, arg, 0);
         break;
     case PyTrace_RETURN: // either normally or with an exception
-        _call_leave(self, frame, arg);
+        if (frame->f_code->co_flags & CO_GENERATOR)
+            _gen_leave(frame);
+        _call_leave(self, frame, arg, 0);
         break;
 
 #ifdef PyTrace_C_CALL	// not defined in Python <= 2.3 
@@ -428,102 +1614,309 @@ _yapp_callback(PyObject *self, PyFrameObject *frame, int what,
     case PyTrace_C_RETURN:
     case PyTrace_C_EXCEPTION:
         if (PyCFunction_Check(arg))
-            _call_leave(self, frame, arg);
+            _call_leave(self, frame, arg, 1); // set ccall to true
         break;
 #endif
     default:
         break;
     }
 
+ctxstats:
     // update ctx statistics
     if (prev_ctx != current_ctx) {
         current_ctx->sched_cnt++;
+        ctxswitches++;
+        if (prev_ctx && prev_ctx->task && !slen(prev_ctx->cs))
+            _retire_task(prev_ctx);
     }
     if (!current_ctx->class_name) {
         current_ctx->class_name = _get_current_thread_class_name();
+        if (current_ctx->shm && current_ctx->class_name)
+            shmsetctxname(current_ctx->shm, current_ctx->class_name);
     }
     prev_ctx = current_ctx;
+    if (t0) {
+        cbtime += tickcount() - t0;
+        evsampled++;
+    }
     return 0;
 }
 
 
+// creates the trace file of the thread in trace mode.
 static void
-_profile_thread(PyThreadState *ts)
+_trace_thread(PyThreadState *ts)
 {
     _ctx *ctx;
+    PyObject *path;
 
-    ctx = _create_ctx();
-    if (!ctx)
+    ctx = _thread2ctx(ts);
+    if (!ctx || ctx->trace)
         return;
 
-    ts->use_tracing = 1;
-    ts->c_profilefunc = _yapp_callback;
-
-    // If a ThreadState object is destroyed, currently yappi does not
-    // delete the associated resources. Instead, we rely on the fact that
-    // the ThreadState objects are actually recycled. We are using pointer
-    // to map to the internal contexts table, and Python VM will try to use
-    // the destructed thread's pointer when a new thread is created. They are
-    // pooled inside the VM. Sp this means we wii use the same pointer for our
-    // hash table like lazy deletion. This is a hecky solution, but there is no
-    // efficient and easy way to somehow know that a Python Thread is about
-    // to be destructed.
-    if (!hadd(contexts, (uintptr_t)ts, (uintptr_t)ctx)) {
-        _del_ctx(ctx);
-        if (!flput(flctx, ctx))
-            yerr("Context cannot be recycled. Possible memory leak.[%d bytes]", sizeof(_ctx));
-        dprintf("Context add failed. Already added?(%p, %ld)", ts,
-                PyThreadState_GET()->thread_id);
+    path = PyString_FromFormat("%s/yappi.%ld.trace", PyString_AS_STRING(tracedir), ctx->id);
+    if (!path) {
+        PyErr_Clear();
+        return;
     }
-    ctx->id = ts->thread_id;
+    ctx->trace = trcreate(PyString_AS_STRING(path), ctx->id, tracesize);
+    Py_DECREF(path);
+}
+
+// creates the event queue of the thread in deferred mode.
+static void
+_defer_thread(PyThreadState *ts)
+{
+    _ctx *ctx;
+    _queue *q;
+
+    ctx = _thread2ctx(ts);
+    if (!ctx || ctx->evq)
+        return;
+
+    q = qcreate(DEFER_QUEUE_SIZE, sizeof(_defevent));
+    if (!q)
+        return;
+    PyThread_acquire_lock(agglock, WAIT_LOCK);
+    ctx->evq = q;
+    PyThread_release_lock(agglock);
 }
 
 static void
 _unprofile_thread(PyThreadState *ts)
 {
-    ts->use_tracing = 0;
+    _ctx *ctx;
+
+    // only the running thread can be untraced through the API, which keeps
+    // the interpreter's count of traced threads right. The line callback of
+    // another thread is left in place and untraces it on its next event.
+    if (ts->c_tracefunc == _yapp_line_callback && ts == PyThreadState_GET())
+        PyEval_SetTrace(NULL, NULL);
+    ctx = yappinitialized ? _thread2ctx(ts) : NULL;
+    if (ctx)
+        ctx->lndepth = 0;
+    ts->use_tracing = (ts->c_tracefunc != NULL);
     ts->c_profilefunc = NULL;
 }
 
+// called when the thread state dict is cleared, which happens when the
+// thread exits. The stats of the context are added to the retired stats and
+// the context is recycled, so a new thread reusing the same thread state
+// pointer starts with a fresh context.
 static void
-_ensure_thread_profiled(PyThreadState *ts)
+_retire_ctx(PyObject *capsule)
 {
-    PyThreadState *p = NULL;
+    PyThreadState *ts;
+    _hitem *it;
+    _ctx *ctx;
 
-    for (p=ts->interp->tstate_head ; p != NULL; p = p->next) {
-        if (ts->c_profilefunc != _yapp_callback)
-            _profile_thread(ts);
-    }
+    if (!yappinitialized)
+        return;
+    ts = (PyThreadState *)PyCapsule_GetPointer(capsule, "yappi.ctx");
+    it = hfind(contexts, (uintptr_t)ts);
+    if (!it)
+        return;
+    ctx = (_ctx *)it->val;
+    // a context of an older generation? (stats cleared in between)
+    if (ctx->gen != (unsigned long)(uintptr_t)PyCapsule_GetContext(capsule))
+        return;
+
+    // objects released after the dict may still run Python code.
+    _unprofile_thread(ts);
+
+    if (flags.deferred)
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+    if (ctx->evq)
+        _drain_queue(ctx);
+    hfree(contexts, it);
+    if (flags.deferred)
+        PyThread_release_lock(agglock);
+
+    _free_retired(ctx);
 }
 
+// ties the lifetime of the context to the thread state by a capsule in its
+// dict.
 static void
-_enum_threads(void (*f) (PyThreadState *))
+_watch_thread(PyThreadState *ts, _ctx *ctx)
 {
-    PyThreadState *p = NULL;
+    PyObject *capsule;
 
-    for (p=PyThreadState_GET()->interp->tstate_head ; p != NULL; p = p->next) {
-        f(p);
+    if (!ts->dict) {
+        ts->dict = PyDict_New();
+        if (!ts->dict) {
+            PyErr_Clear();
+            return;
+        }
+    }
+    capsule = PyCapsule_New(ts, "yappi.ctx", _retire_ctx);
+    if (!capsule) {
+        PyErr_Clear();
+        return;
     }
+    PyCapsule_SetContext(capsule, (void *)(uintptr_t)ctx->gen);
+    if (PyDict_SetItemString(ts->dict, "__yappi_ctx__", capsule) < 0)
+        PyErr_Clear();
+    Py_DECREF(capsule);
 }
 
+// adds the shared memory record of the thread.
+static void
+_shm_thread(PyThreadState *ts)
+{
+    _ctx *ctx;
+
+    ctx = _thread2ctx(ts);
+    if (!ctx || ctx->shm)
+        return;
+
+    ctx->shm = shmaddctx(shm, ctx->id);
+    if (!ctx->shm)
+        return;
+    if (ctx->class_name)
+        shmsetctxname(ctx->shm, ctx->class_name);
+    shmupdctx(ctx->shm, ctx->sched_cnt, ctx->ttotal);
+}
+
+// pushes the frame and its callers to the callstack, outermost first, as
+// if they were called at t. Returns 0 if a push failed, the frames inside
+// the failed one are not pushed then.
 static int
-_init_profiler(void)
+_seed_frames(_ctx *ctx, PyFrameObject *frame, long long t)
 {
-    // already initialized? only after clear_stats() and first time, this flag
-    // will be unset.
-    if (!yappinitialized) {
-        contexts = htcreate(HT_CTX_SIZE);
-        if (!contexts)
-            return 0;
+    _pit *cp;
+    _cstackitem *ci;
+
+    if (!frame)
+        return 1;
+    if (!_seed_frames(ctx, frame->f_back, t))
+        return 0;
+    cp = _code2pit(pits, frame->f_code);
+    if (!cp) {
+        PyErr_Clear();
+        return 1;
+    }
+    ci = _pit_enter(ctx, cp, t, 0);
+    if (!ci)
+        return 0;
+    ci->cold = 0; // it was called before t
+    return 1;
+}
+
+// profiles the thread, frame is the innermost frame it is running.
+static void
+_profile_thread_at(PyThreadState *ts, PyFrameObject *frame)
+{
+    _ctx *ctx;
+    int added;
+
+    ctx = _create_ctx();
+    if (!ctx)
+        return;
+
+    ts->use_tracing = 1;
+    ts->c_profilefunc = _yapp_callback;
+
+    // Contexts are mapped by the ThreadState pointer, which the VM reuses
+    // for new threads. The context is retired by _watch_thread() when the
+    // thread exits, so a new thread does not inherit its stats.
+    if (flags.deferred)
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+    added = hadd(contexts, (uintptr_t)ts, (uintptr_t)ctx);
+    if (flags.deferred)
+        PyThread_release_lock(agglock);
+    if (!added) {
+        _del_ctx(ctx);
+        if (!flput(flctx, ctx))
+            yerr("Context cannot be recycled. Possible memory leak.[%lu bytes]", (unsigned long)sizeof(_ctx));
+        dprintf("Context add failed. Already added?(%p, %ld)", ts,
+                PyThreadState_GET()->thread_id);
+    } else {
+        ctx->id = ts->thread_id;
+        _watch_thread(ts, ctx);
+        // the thread may be deep inside functions that return while we
+        // profile, so they are accounted from now on. The aggregator does
+        // not see the context before _defer_thread().
+        if (!tracedir) {
+            _seed_frames(ctx, frame, tickcount());
+            ctx->seeded = slen(ctx->cs);
+        }
+    }
+
+    if (tracedir)
+        _trace_thread(ts);
+    if (flags.deferred)
+        _defer_thread(ts);
+    if (shm)
+        _shm_thread(ts);
+}
+
+static void
+_profile_thread(PyThreadState *ts)
+{
+    _profile_thread_at(ts, ts->frame);
+}
+
+static void
+_ensure_thread_profiled(PyThreadState *ts, PyFrameObject *frame)
+{
+    PyThreadState *p = NULL;
+
+    for (p=ts->interp->tstate_head ; p != NULL; p = p->next) {
+        if (ts->c_profilefunc != _yapp_callback)
+            _profile_thread_at(ts, frame);
+    }
+}
+
+static void
+_enum_threads(void (*f) (PyThreadState *))
+{
+    PyThreadState *p = NULL;
+
+    for (p=PyThreadState_GET()->interp->tstate_head ; p != NULL; p = p->next) {
+        f(p);
+    }
+}
+
+static int
+_init_profiler(void)
+{
+    // already initialized? only after clear_stats() and first time, this flag
+    // will be unset.
+    if (!yappinitialized) {
+        contexts = htcreate(HT_CTX_SIZE);
+        if (!contexts)
+            return 0;
         pits = htcreate(HT_PIT_SIZE);
         if (!pits)
             return 0;
-        flpit = flcreate(sizeof(_pit), FL_PIT_SIZE);
+        codes = htcreate(HT_CODE_SIZE);
+        if (!codes)
+            return 0;
+        gens = htcreate(HT_GEN_SIZE);
+        if (!gens)
+            return 0;
+        tags = htcreate(HT_TAG_SIZE);
+        if (!tags)
+            return 0;
+        tasks = htcreate(HT_CTX_SIZE);
+        if (!tasks)
+            return 0;
+        coderefs = PyDict_New();
+        if (!coderefs)
+            return 0;
+        flpit = flcreate(sizeof(_pit), FL_PIT_SIZE, YMEM_PIT);
         if (!flpit)
             return 0;
-        flctx = flcreate(sizeof(_ctx), FL_CTX_SIZE);
+        flctx = flcreate(sizeof(_ctx), FL_CTX_SIZE, YMEM_CTX);
         if (!flctx)
             return 0;
+        flgen = flcreate(sizeof(_gen), FL_GEN_SIZE, YMEM_PIT);
+        if (!flgen)
+            return 0;
+        slowcalls = rcreate(SLOW_RING_SIZE, sizeof(_slowcall));
+        if (!slowcalls)
+            return 0;
         yappinitialized = 1;
         statshead = NULL;
         current_ctx = NULL;
@@ -544,10 +1937,13 @@ profile_event(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    _ensure_thread_profiled(PyThreadState_GET());
-
     ev = PyString_AS_STRING(event);
 
+    // the frame of a call event is not running yet, it is pushed by the
+    // event itself. ts->frame is the frame of the Python level callback.
+    _ensure_thread_profiled(PyThreadState_GET(),
+                            strcmp("call", ev)==0 ? frame->f_back : frame);
+
     if (strcmp("call", ev)==0)
         _yapp_callback(self, frame, PyTrace_CALL, arg);
     else if (strcmp("return", ev)==0)
@@ -563,33 +1959,257 @@ profile_event(PyObject *self, PyObject *args)
     return Py_None;
 }
 
+static int
+_pitenumtracename(_hitem *item, void *arg)
+{
+    _trace_name((_pit *)item->val);
+    return 0;
+}
+
+// opens the names file of the trace in the given directory. The names of
+// the pits that already exist are written first.
+static int
+_start_trace(PyObject *dir, long long size)
+{
+    PyObject *path;
+
+    if (!PyString_Check(dir)) {
+        PyErr_SetString(YappiProfileError, "trace_dir must be a string.");
+        return 0;
+    }
+    if (size < 1) {
+        PyErr_SetString(YappiProfileError, "trace_size cannot be less than 1.");
+        return 0;
+    }
+
+    path = PyString_FromFormat("%s/yappi.names", PyString_AS_STRING(dir));
+    if (!path)
+        return 0;
+    tracenames = fopen(PyString_AS_STRING(path), "w");
+    Py_DECREF(path);
+    if (!tracenames) {
+        PyErr_SetString(YappiProfileError, "trace names file cannot be created.");
+        return 0;
+    }
+
+    Py_INCREF(dir);
+    tracedir = dir;
+    tracesize = size;
+    henum(pits, _pitenumtracename, NULL);
+    return 1;
+}
+
+static int
+_pitenumshm(_hitem *item, void *arg)
+{
+    _shm_addpit((_pit *)item->val);
+    return 0;
+}
+
+// creates the shared memory file the stats are published to. The pits that
+// already exist are published first.
+static int
+_start_shm(PyObject *path)
+{
+    if (!PyString_Check(path)) {
+        PyErr_SetString(YappiProfileError, "shm_path must be a string.");
+        return 0;
+    }
+
+    shm = shmcreate(PyString_AS_STRING(path), SHM_PIT_COUNT, SHM_CTX_COUNT);
+    if (!shm) {
+        PyErr_SetString(YappiProfileError, "shared memory file cannot be created.");
+        return 0;
+    }
+    shm->hdr->tickfactor = tickfactor();
+    shm->hdr->timing_sample = flags.timing_sample;
+    shm->hdr->running = 1;
+    henum(pits, _pitenumshm, NULL);
+    return 1;
+}
+
+static int
+_pitenumshmclose(_hitem *item, void *arg)
+{
+    ((_pit *)item->val)->shm = NULL;
+    return 0;
+}
+
+static int
+_ctxenumshmclose(_hitem *item, void *arg)
+{
+    ((_ctx *)item->val)->shm = NULL;
+    return 0;
+}
+
+// unmaps the shared memory file, the last published stats stay in it.
+static void
+_stop_shm(void)
+{
+    henum(pits, _pitenumshmclose, NULL);
+    henum(contexts, _ctxenumshmclose, NULL);
+    shm->hdr->running = 0;
+    shmdestroy(shm);
+    shm = NULL;
+}
+
+static int
+_start_aggregator(void)
+{
+    aggrunning = 1;
+    PyThread_acquire_lock(aggexit, WAIT_LOCK);
+    if (PyThread_start_new_thread(_aggregator, NULL) == -1) {
+        PyThread_release_lock(aggexit);
+        aggrunning = 0;
+        PyErr_SetString(YappiProfileError, "aggregator thread cannot be started.");
+        return 0;
+    }
+    return 1;
+}
+
+static int
+_ctxenumdeferclose(_hitem *item, void *arg)
+{
+    _ctx *ctx;
+
+    ctx = (_ctx *)item->val;
+    if (ctx->evq) {
+        _drain_queue(ctx);
+        qdestroy(ctx->evq);
+        ctx->evq = NULL;
+    }
+    return 0;
+}
+
+// waits for the aggregator thread to exit and does the accounting of the
+// events that are still queued.
+static void
+_stop_aggregator(void)
+{
+    aggrunning = 0;
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(aggexit, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(aggexit);
+
+    henum(contexts, _ctxenumdeferclose, NULL);
+}
+
 static PyObject*
 start(PyObject *self, PyObject *args)
 {
+    PyObject *hist, *tdir, *shmpath, *lines;
+    long long tsize;
+    int deferred, dedup, cold;
+    unsigned long mem;
+
     if (yapprunning) {
         PyErr_SetString(YappiProfileError, "profiler is already started. yappi is a per-interpreter resource.");
         return NULL;
     }
 
-    if (!PyArg_ParseTuple(args, "ii", &flags.builtins, &flags.timing_sample))
+    hist = tdir = shmpath = lines = NULL;
+    tsize = TRACE_RING_SIZE;
+    deferred = 0;
+    mem = 0;
+    dedup = 0;
+    cold = COLD_CALLS;
+    if (!PyArg_ParseTuple(args, "ii|OOLiOkiOi", &flags.builtins, &flags.timing_sample, &hist,
+                          &tdir, &tsize, &deferred, &shmpath, &mem, &dedup, &lines, &cold))
+        return NULL;
+    if (lines == Py_None)
+        lines = NULL;
+
+    if (deferred && tdir && tdir != Py_None) {
+        PyErr_SetString(YappiProfileError, "trace and deferred modes cannot be used together.");
+        return NULL;
+    }
+
+    if (lines && (deferred || (tdir && tdir != Py_None))) {
+        PyErr_SetString(YappiProfileError, "line profiling cannot be used in trace or deferred mode.");
         return NULL;
+    }
+
+    if (ctxidcb && (lines || deferred || (tdir && tdir != Py_None))) {
+        PyErr_SetString(YappiProfileError, "context id callback cannot be used with line profiling, trace or deferred mode.");
+        return NULL;
+    }
 
     if (flags.timing_sample < 1) {
         PyErr_SetString(YappiProfileError, "profiler timing sample value cannot be less than 1.");
         return NULL;
     }
 
+    if (cold < 0) {
+        PyErr_SetString(YappiProfileError, "cold calls cannot be negative.");
+        return NULL;
+    }
+
+    Py_CLEAR(linefilter);
+    if (lines) {
+        linefilter = PyDict_New();
+        if (!linefilter)
+            return NULL;
+        if (_names2dict(linefilter, lines, Py_None) < 0) {
+            Py_CLEAR(linefilter);
+            return NULL;
+        }
+    }
+
+    // latency_hist is either a bool or a list of function names.
+    Py_CLEAR(histfilter);
+    flags.latency_hist = 0;
+    if (hist && PySequence_Check(hist) && !PyString_Check(hist)) {
+        histfilter = PyDict_New();
+        if (!histfilter)
+            return NULL;
+        if (_names2dict(histfilter, hist, Py_None) < 0) {
+            Py_CLEAR(histfilter);
+            return NULL;
+        }
+        flags.latency_hist = 1;
+    } else if (hist) {
+        flags.latency_hist = PyObject_IsTrue(hist);
+        if (flags.latency_hist < 0)
+            return NULL;
+    }
+
     if (!_init_profiler()) {
         PyErr_SetString(YappiProfileError, "profiler cannot be initialized.");
         return NULL;
     }
 
+    if (tdir && tdir != Py_None) {
+        if (!_start_trace(tdir, tsize))
+            return NULL;
+    }
+
+    if (shmpath && shmpath != Py_None) {
+        if (!_start_shm(shmpath))
+            return NULL;
+    }
+
+    maxmem = mem;
+    flags.dedup = dedup;
+    flags.deferred = deferred;
+    flags.cold_calls = cold;
     _enum_threads(&_profile_thread);
 
+    if (flags.deferred && !_start_aggregator()) {
+        henum(contexts, _ctxenumdeferclose, NULL);
+        flags.deferred = 0;
+        _enum_threads(&_unprofile_thread);
+        if (shm)
+            _stop_shm();
+        return NULL;
+    }
+
     yapprunning = 1;
     yapphavestats = 1;
     time (&yappstarttime);
     yappstarttick = tickcount();
+    if (shm)
+        shm->hdr->tstart = yappstarttime;
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -616,6 +2236,8 @@ _pitenumstat(_hitem *item, void * arg)
     _pit *pt;
 
     pt = (_pit *)item->val;
+    if (tagfilter && pt->tag != tagfilter)
+        return 0;
     cumdiff = _calc_cumdiff(pt->ttotal, pt->tsubtotal);
     efn = (PyObject *)arg;
 
@@ -736,7 +2358,7 @@ _create_statitem(char *fname, unsigned long callcount, double ttot, double tsub,
 {
     _statitem *si;
 
-    si = (_statitem *)ymalloc(sizeof(_statitem));
+    si = (_statitem *)ytmalloc(sizeof(_statitem), YMEM_STATS);
     if (!si)
         return NULL;
 
@@ -850,6 +2472,8 @@ _pitenumstat2(_hitem *item, void * arg)
     _statnode *sni;
 
     pt = (_pit *)item->val;
+    if (tagfilter && pt->tag != tagfilter)
+        return 0;
     cumdiff = _calc_cumdiff(pt->ttotal, pt->tsubtotal);
     fname = _item2fname(pt);
     if (!fname)
@@ -861,11 +2485,11 @@ _pitenumstat2(_hitem *item, void * arg)
 
     si = _create_statitem(fname, pt->callcount, pt->ttotal * tickfactor() * flags.timing_sample,
                           cumdiff * tickfactor() * flags.timing_sample,
-                          (pt->ttotal * tickfactor() * flags.timing_sample) / pt->callcount);
+                          pt->callcount ? (pt->ttotal * tickfactor() * flags.timing_sample) / pt->callcount : 0.0);
 
     if (!si)
         return 1; // abort enumeration
-    sni = (_statnode *)ymalloc(sizeof(_statnode));
+    sni = (_statnode *)ytmalloc(sizeof(_statnode), YMEM_STATS);
     if (!sni)
         return 1; // abort enumeration
     sni->it = si;
@@ -876,234 +2500,1518 @@ _pitenumstat2(_hitem *item, void * arg)
 }
 
 static int
-_pitenumdel(_hitem *item, void *arg)
+_pitenumdel(_hitem *item, void *arg)
+{
+    _del_pit((_pit *)item->val);
+    return 0;
+}
+
+static int
+_tagenumdel(_hitem *item, void *arg)
+{
+    _tag *tag;
+
+    tag = (_tag *)item->val;
+    Py_DECREF(tag->name);
+    htdestroy(tag->pits); // the pits are freed with the pits table.
+    yfree(tag);
+    return 0;
+}
+
+static int
+_ctxenumdel(_hitem *item, void *arg)
+{
+    _del_ctx(((_ctx *)item->val) );
+    return 0;
+}
+
+static int
+_ctxenumstat(_hitem *item, void *arg)
+{
+    char *fname, *tcname;
+    _ctx * ctx;
+    char temp[LINE_LEN];
+    PyObject *buf;
+
+    ctx = (_ctx *)item->val;
+
+    fname = _item2fname(ctx->last_pit);
+    if (!fname)
+        fname = "N/A";
+
+    memset(temp, 0, LINE_LEN);
+
+    tcname = ctx->class_name;
+    if (tcname == NULL)
+        tcname = "N/A";
+
+    _yformat_string(tcname, temp, THREAD_NAME_LEN);
+    _yformat_long(ctx->id, temp);
+    _yformat_string(fname, temp, FUNC_NAME_LEN);
+    _yformat_ulong(ctx->sched_cnt, temp);
+    _yformat_double(ctx->ttotal * tickfactor(), temp);
+
+
+    buf = PyString_FromString(temp);
+    if (!buf)
+        return 0; // just continue.
+
+    if (PyList_Append((PyObject *)arg, buf) < 0)
+        return 0; // just continue.
+
+    return 0;
+}
+
+// a single line for the threads that have exited.
+static void
+_retiredstat(PyObject *li)
+{
+    char temp[LINE_LEN], tcname[THREAD_NAME_LEN+1];
+    PyObject *buf;
+
+    if (!retiredcnt)
+        return;
+
+    memset(temp, 0, LINE_LEN);
+    PyOS_snprintf(tcname, sizeof(tcname), "retired(%lu)", retiredcnt);
+    _yformat_string(tcname, temp, THREAD_NAME_LEN);
+    _yformat_long(0, temp);
+    _yformat_string("N/A", temp, FUNC_NAME_LEN);
+    _yformat_ulong(retiredsched, temp);
+    _yformat_double(retiredttotal * tickfactor(), temp);
+
+    buf = PyString_FromString(temp);
+    if (!buf)
+        return;
+    if (PyList_Append(li, buf) < 0)
+        PyErr_Clear();
+    Py_DECREF(buf);
+}
+
+static int
+_ctxenumtraceclose(_hitem *item, void *arg)
+{
+    _ctx *ctx;
+
+    ctx = (_ctx *)item->val;
+    if (ctx->trace) {
+        trdestroy(ctx->trace);
+        ctx->trace = NULL;
+    }
+    return 0;
+}
+
+static PyObject*
+stop(PyObject *self, PyObject *args)
+{
+    if (!yapprunning) {
+        PyErr_SetString(YappiProfileError, "profiler is not started yet.");
+        return NULL;
+    }
+
+    _enum_threads(&_unprofile_thread);
+
+    if (flags.deferred) {
+        _stop_aggregator();
+        flags.deferred = 0;
+    }
+
+    if (tracedir) {
+        henum(contexts, _ctxenumtraceclose, NULL);
+        fclose(tracenames);
+        tracenames = NULL;
+        Py_CLEAR(tracedir);
+    }
+
+    if (shm)
+        _stop_shm();
+
+    yapprunning = 0;
+    yappstoptick = tickcount();
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_ctxenumicstats(_hitem *item, void *arg)
+{
+    unsigned long *r;
+
+    r = (unsigned long *)arg;
+    r[0] += ((_ctx *)item->val)->ichits;
+    r[1] += ((_ctx *)item->val)->icmisses;
+    return 0;
+}
+
+static PyObject*
+get_icache_stats(PyObject *self, PyObject *args)
+{
+    unsigned long r[2];
+
+    r[0] = retiredichits;
+    r[1] = retiredicmisses;
+    if (yappinitialized)
+        henum(contexts, _ctxenumicstats, r);
+    return Py_BuildValue("{s:k,s:k}", "hits", r[0], "misses", r[1]);
+}
+
+static int
+_ctxenumcsstats(_hitem *item, void *arg)
+{
+    _csstats_add((_csstats *)arg, ((_ctx *)item->val)->cs);
+    return 0;
+}
+
+static PyObject *
+_htstats2dict(_htstats *s)
+{
+    return Py_BuildValue("{s:k,s:k,s:k,s:d}", "lookups", s->lookups, "probes", s->probes,
+                         "grows", s->grows, "grow_time", s->growtime * tickfactor());
+}
+
+// counters of the profiler itself since the stats were last cleared.
+static PyObject*
+get_profiler_stats(PyObject *self, PyObject *args)
+{
+    int i;
+    unsigned long total, other;
+    double cbt;
+    _csstats cs;
+    _htstats pt, ct, cot;
+    unsigned long flpitgrows, flctxgrows;
+
+    memset(&pt, 0, sizeof(pt));
+    memset(&ct, 0, sizeof(ct));
+    memset(&cot, 0, sizeof(cot));
+    cs = retiredcs;
+    flpitgrows = flctxgrows = 0;
+    if (yappinitialized) {
+        _htstats_add(&pt, pits);
+        _htstats_add(&ct, contexts);
+        _htstats_add(&cot, codes);
+        henum(contexts, _ctxenumcsstats, &cs);
+        flpitgrows = flpit->grows;
+        flctxgrows = flctx->grows;
+    }
+
+    total = 0;
+    for(i=0; i<EVENT_TYPES; i++)
+        total += evcounts[i];
+    other = total - evcounts[PyTrace_CALL] - evcounts[PyTrace_RETURN];
+#ifdef PyTrace_C_CALL
+    other -= evcounts[PyTrace_C_CALL] + evcounts[PyTrace_C_RETURN] +
+             evcounts[PyTrace_C_EXCEPTION];
+#endif
+    // scale the sampled time up to all events.
+    cbt = evsampled ? cbtime * tickfactor() * total / evsampled : 0.0;
+
+    return Py_BuildValue("{s:{s:k,s:k,s:k,s:k,s:k,s:k},s:d,s:k,s:{s:N,s:N,s:N,s:N},"
+                         "s:k,s:k,s:k,s:k,s:k}",
+                         "events",
+                         "call", evcounts[PyTrace_CALL],
+                         "return", evcounts[PyTrace_RETURN],
+#ifdef PyTrace_C_CALL
+                         "c_call", evcounts[PyTrace_C_CALL],
+                         "c_return", evcounts[PyTrace_C_RETURN],
+                         "c_exception", evcounts[PyTrace_C_EXCEPTION],
+#else
+                         "c_call", 0UL, "c_return", 0UL, "c_exception", 0UL,
+#endif
+                         "other", other,
+                         "callback_time", cbt,
+                         "callback_samples", evsampled,
+                         "tables",
+                         "pits", _htstats2dict(&pt),
+                         "contexts", _htstats2dict(&ct),
+                         "codes", _htstats2dict(&cot),
+                         "callstacks", _htstats2dict(&cs.counts),
+                         "stack_grows", cs.grows,
+                         "pit_freelist_grows", flpitgrows,
+                         "ctx_freelist_grows", flctxgrows,
+                         "stack_underflows", stackunderflows,
+                         "context_switches", ctxswitches);
+}
+
+static PyObject *
+_ymemtag2dict(int tag)
+{
+    return Py_BuildValue("{s:k,s:k}", "usage", ymemtagusage(tag), "peak", ymemtagpeak(tag));
+}
+
+static PyObject*
+get_mem_stats(PyObject *self, PyObject *args)
+{
+    return Py_BuildValue("{s:k,s:k,s:k,s:k,s:i,s:i,s:{s:N,s:N,s:N,s:N,s:N,s:N}}",
+                         "usage", ymemusage(), "peak", ymempeak(), "max_memory", maxmem,
+                         "folded_calls", foldedcalls,
+                         "pits", yappinitialized ? hcount(pits) : 0,
+                         "contexts", yappinitialized ? hcount(contexts) : 0,
+                         "subsystems",
+                         "pits", _ymemtag2dict(YMEM_PIT),
+                         "contexts", _ymemtag2dict(YMEM_CTX),
+                         "hashtables", _ymemtag2dict(YMEM_HTAB),
+                         "callstacks", _ymemtag2dict(YMEM_CSTACK),
+                         "stats", _ymemtag2dict(YMEM_STATS),
+                         "other", _ymemtag2dict(YMEM_OTHER));
+}
+
+// returns the tag of the given name, it is created if create is set. NULL
+// is returned if there is no such tag or on error.
+static _tag *
+_get_tag(PyObject *name, int create)
+{
+    int eq;
+    long h;
+    uintptr_t key;
+    _hitem *it;
+    _tag *tag;
+
+    h = PyObject_Hash(name);
+    if (h == -1)
+        return NULL;
+
+    // tags with colliding hashes are stored on the next free key.
+    for(key=(uintptr_t)h; ; key++) {
+        it = hfind(tags, key);
+        if (!it)
+            break;
+        tag = (_tag *)it->val;
+        eq = PyObject_RichCompareBool(tag->name, name, Py_EQ);
+        if (eq < 0)
+            return NULL;
+        if (eq)
+            return tag;
+    }
+    if (!create)
+        return NULL;
+
+    tag = ytmalloc(sizeof(_tag), YMEM_PIT);
+    if (!tag)
+        return NULL;
+    tag->pits = htcreate(HT_PIT_SIZE);
+    if (!tag->pits) {
+        yfree(tag);
+        return NULL;
+    }
+    if (!hadd(tags, key, (uintptr_t)tag)) {
+        htdestroy(tag->pits);
+        yfree(tag);
+        return NULL;
+    }
+    Py_INCREF(name);
+    tag->name = name;
+    return tag;
+}
+
+// sets tagfilter for the stats of the given tag, None is for all stats.
+// Returns 0 if no pit can match.
+static int
+_set_tagfilter(PyObject *name)
+{
+    tagfilter = NULL;
+    if (name == Py_None)
+        return 1;
+    if (!tags)
+        return 0;
+    tagfilter = _get_tag(name, 0);
+    return tagfilter != NULL;
+}
+
+static PyObject*
+set_tag(PyObject *self, PyObject *args)
+{
+    PyObject *name;
+    _ctx *ctx;
+    _tag *tag;
+
+    if (!PyArg_ParseTuple(args, "O", &name))
+        return NULL;
+
+    // the tag belongs to the context of the thread or task, there is none
+    // yet if the thread is not profiled.
+    ctx = NULL;
+    if (yappinitialized) {
+        ctx = ctxidcb ? _task2ctx() : NULL;
+        if (!ctx)
+            ctx = _thread2ctx(PyThreadState_GET());
+    }
+    if (!ctx) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    tag = NULL;
+    if (name != Py_None) {
+        tag = _get_tag(name, 1);
+        if (!tag) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(YappiProfileError, "tag cannot be allocated.");
+            return NULL;
+        }
+    }
+    // the cached pits are the ones of the previous tag.
+    if (ctx->tag != tag) {
+        ctx->tag = tag;
+        memset(ctx->icache, 0, sizeof(ctx->icache));
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+set_context_id_callback(PyObject *self, PyObject *args)
+{
+    PyObject *cb;
+    long (*fn)(void);
+
+    if (!PyArg_ParseTuple(args, "O", &cb))
+        return NULL;
+
+    if (yapprunning) {
+        PyErr_SetString(YappiProfileError,
+                        "profiler is running. Stop profiler before setting the context id callback.");
+        return NULL;
+    }
+
+    fn = NULL;
+    if (cb == Py_None) {
+        cb = NULL;
+    } else if (PyCapsule_CheckExact(cb)) {
+        fn = (long (*)(void))PyCapsule_GetPointer(cb, CTXID_CAPSULE_NAME);
+        if (!fn)
+            return NULL;
+    } else if (!PyCallable_Check(cb)) {
+        PyErr_SetString(YappiProfileError, "context id callback must be callable");
+        return NULL;
+    }
+
+    Py_XINCREF(cb);
+    Py_XDECREF(ctxidcb);
+    ctxidcb = cb;
+    ctxidfn = fn;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+is_running(PyObject *self, PyObject *args)
+{
+    return PyBool_FromLong(yapprunning);
+}
+
+static PyObject*
+clear_stats(PyObject *self, PyObject *args)
+{
+    if (yapprunning) {
+        PyErr_SetString(YappiProfileError,
+                        "profiler is running. Stop profiler before clearing stats.");
+        return NULL;
+    }
+
+    Py_CLEAR(coderefs);
+    htdestroy(codes);
+    htdestroy(gens); // unfinished generators are freed with flgen.
+    henum(tags, _tagenumdel, NULL);
+    htdestroy(tags);
+    htdestroy(tasks); // the contexts are freed with the contexts table.
+    henum(pits, _pitenumdel, NULL);
+    htdestroy(pits);
+    henum(contexts, _ctxenumdel, NULL);
+    htdestroy(contexts);
+    while (cspoolcnt)
+        sdestroy(cspool[--cspoolcnt]);
+    retiredcnt = retiredsched = 0;
+    retiredttotal = 0;
+    retiredichits = retiredicmisses = 0;
+    memset(&retiredcs, 0, sizeof(retiredcs));
+    memset(evcounts, 0, sizeof(evcounts));
+    evseq = evsampled = 0;
+    cbtime = 0;
+    stackunderflows = ctxswitches = 0;
+
+    fldestroy(flpit);
+    fldestroy(flctx);
+    fldestroy(flgen);
+    rdestroy(slowcalls);
+    pitcount = 0;
+    otherpit = NULL;
+    foldedcalls = 0;
+    yappinitialized = 0;
+    yapphavestats = 0;
+    ymemresetpeak();
+
+// check for mem leaks if DEBUG_MEM is specified
+#ifdef DEBUG_MEM
+    YMEMLEAKCHECK();
+#endif
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+get_stats(PyObject *self, PyObject *args)
+{
+
+    char *prof_state,*timestr;
+    _statnode *p;
+    PyObject *buf,*li,*tag;
+    int type, order, limit, fcnt;
+    char temp[LINE_LEN];
+    long long appttotal;
+
+    li = buf = NULL;
+    tag = Py_None;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        goto err;
+    }
+
+    if (!PyArg_ParseTuple(args, "iii|O", &type, &order, &limit, &tag)) {
+        PyErr_SetString(YappiProfileError, "invalid param to get_stats");
+        goto err;
+    }
+    // sorttype/order/limit is in valid bounds?
+    if ((type < 0) || (type > STAT_SORT_TYPE_MAX)) {
+        PyErr_SetString(YappiProfileError, "sorttype param for get_stats is out of bounds");
+        goto err;
+    }
+    if ((order < 0) || (order > STAT_SORT_ORDER_MAX)) {
+        PyErr_SetString(YappiProfileError, "sortorder param for get_stats is out of bounds");
+        goto err;
+    }
+    if (limit < STAT_SHOW_ALL) {
+        PyErr_SetString(YappiProfileError, "limit param for get_stats is out of bounds");
+        goto err;
+    }
+
+
+
+    _flush_deferred();
+
+    // enum and present stats in a linked list.(statshead). An unknown tag
+    // has no stats.
+    if (_set_tagfilter(tag))
+        henum(pits, _pitenumstat2, (void *)type);
+    tagfilter = NULL;
+    if (PyErr_Occurred())
+        goto err;
+    _order_stats_internal(order);
+
+    li = PyList_New(0);
+    if (!li)
+        goto err;
+    if (PyList_Append(li, PyString_FromString(STAT_HEADER_STR)) < 0)
+        goto err;
+
+    fcnt = 0;
+    p = statshead;
+    while(p) {
+        // limit reached?
+        if (limit != STAT_SHOW_ALL) {
+            if (fcnt == limit)
+                break;
+        }
+        buf = PyString_FromString(p->it->result);
+        if (!buf)
+            goto err;
+        if (PyList_Append(li, buf) < 0)
+            goto err;
+
+        Py_DECREF(buf);
+        fcnt++;
+        p = p->next;
+    }
+
+    if (PyList_Append(li, PyString_FromString(STAT_FOOTER_STR)) < 0)
+        goto err;
+
+    henum(contexts, _ctxenumstat, (void *)li);
+    _retiredstat(li);
+
+    if (PyList_Append(li, PyString_FromString(STAT_FOOTER_STR2)) < 0)
+        goto err;
+
+    if (yapprunning) {
+        appttotal = tickcount()-yappstarttick;
+        prof_state = "running";
+    } else {
+        appttotal = yappstoptick - yappstarttick;
+        prof_state = "stopped";
+    }
+
+    memset(temp, 0, LINE_LEN);
+    _yformat_string(prof_state, temp, DOUBLE_COLUMN_LEN);
+
+    // FIX: Issue #13.
+    // ctime() string is a static allocated block of char and it is followed by a '\n'
+    // char let's exclude it. See:
+    // http://www.cplusplus.com/reference/clibrary/ctime/ctime/
+    timestr = ctime(&yappstarttime);
+    timestr[strlen(timestr)-1] = '\0';
+
+    _yformat_string(timestr, temp, TIMESTR_COLUMN_LEN);
+    _yformat_int(hcount(pits), temp);
+    _yformat_int(hcount(contexts), temp);
+    _yformat_ulong(ymemusage(), temp);
+
+    if (PyList_Append(li, PyString_FromString(temp)) < 0)
+        goto err;
+
+    // clear the internal pit stat items that are generated temporarily.
+    _clear_stats_internal();
+
+    return li;
+err:
+    _clear_stats_internal();
+    Py_XDECREF(li);
+    Py_XDECREF(buf);
+    return NULL;
+}
+
+static PyObject*
+enum_stats(PyObject *self, PyObject *args)
+{
+    PyObject *enumfn, *tag;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        return NULL;
+    }
+
+    tag = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O", &enumfn, &tag)) {
+        PyErr_SetString(YappiProfileError, "invalid param to enum_stats");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(enumfn)) {
+        PyErr_SetString(YappiProfileError, "enum function must be callable");
+        return NULL;
+    }
+
+    _flush_deferred();
+    if (_set_tagfilter(tag))
+        henum(pits, _pitenumstat, enumfn);
+    tagfilter = NULL;
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_pitenumlatency(_hitem *item, void *arg)
+{
+    _pit *pt;
+    char *fname;
+    double tf;
+    PyObject *r;
+
+    pt = (_pit *)item->val;
+    if (!pt->hist || !pt->hist->count)
+        return 0;
+
+    // do not show builtin pits if specified
+    if  ((!flags.builtins) && (pt->builtin))
+        return 0;
+
+    fname = _item2fname(pt);
+    if (!fname)
+        fname = "N/A";
+
+    // percentiles are per-call durations of the sampled calls, so unlike
+    // the totals they are not multiplied with the timing_sample.
+    tf = tickfactor();
+    r = PyObject_CallFunction((PyObject *)arg, "((skffff))", fname, pt->hist->count,
+                              histpercentile(pt->hist, 0.50) * tf,
+                              histpercentile(pt->hist, 0.90) * tf,
+                              histpercentile(pt->hist, 0.99) * tf,
+                              pt->hist->max * tf);
+    Py_XDECREF(r);
+    return 0;
+}
+
+static PyObject*
+enum_latency_stats(PyObject *self, PyObject *args)
+{
+    PyObject *enumfn;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        return NULL;
+    }
+
+    if (!PyArg_ParseTuple(args, "O", &enumfn)) {
+        PyErr_SetString(YappiProfileError, "invalid param to enum_latency_stats");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(enumfn)) {
+        PyErr_SetString(YappiProfileError, "enum function must be callable");
+        return NULL;
+    }
+
+    _flush_deferred();
+    henum(pits, _pitenumlatency, enumfn);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_pitenumlines(_hitem *item, void *arg)
+{
+    int i;
+    _pit *pt;
+    char *fname;
+    PyObject *r;
+    _linestat *ls;
+
+    pt = (_pit *)item->val;
+    if (!pt->lines)
+        return 0;
+
+    fname = _item2fname(pt);
+    if (!fname)
+        fname = "N/A";
+
+    // lines are not sampled, the times are not multiplied with timing_sample.
+    for(i=0; i<pt->lines->count; i++) {
+        ls = &pt->lines->lines[i];
+        if (!ls->hits)
+            continue;
+        r = PyObject_CallFunction((PyObject *)arg, "((sOikf))", fname,
+                                  ((PyCodeObject *)pt->co)->co_filename,
+                                  pt->lines->first + i, ls->hits,
+                                  ls->ttotal * tickfactor());
+        if (!r)
+            return 1;
+        Py_DECREF(r);
+    }
+    return 0;
+}
+
+static PyObject*
+enum_line_stats(PyObject *self, PyObject *args)
+{
+    PyObject *enumfn;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        return NULL;
+    }
+
+    if (!PyArg_ParseTuple(args, "O", &enumfn)) {
+        PyErr_SetString(YappiProfileError, "invalid param to enum_line_stats");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(enumfn)) {
+        PyErr_SetString(YappiProfileError, "enum function must be callable");
+        return NULL;
+    }
+
+    PyErr_Clear();
+    henum(pits, _pitenumlines, enumfn);
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_pitenumgen(_hitem *item, void *arg)
+{
+    _pit *pt;
+    char *fname;
+    PyObject *r;
+
+    pt = (_pit *)item->val;
+    if (!pt->resumes && !pt->nlife)
+        return 0;
+
+    fname = _item2fname(pt);
+    if (!fname)
+        fname = "N/A";
+
+    // the lifetime is measured on every call, it is not sampled.
+    r = PyObject_CallFunction((PyObject *)arg, "((skkfkf))", fname,
+                              pt->callcount, pt->resumes,
+                              pt->ttotal * tickfactor() * flags.timing_sample,
+                              pt->nlife, pt->tlife * tickfactor());
+    if (!r)
+        return 1;
+    Py_DECREF(r);
+    return 0;
+}
+
+static PyObject*
+enum_generator_stats(PyObject *self, PyObject *args)
+{
+    PyObject *enumfn;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        return NULL;
+    }
+
+    if (!PyArg_ParseTuple(args, "O", &enumfn)) {
+        PyErr_SetString(YappiProfileError, "invalid param to enum_generator_stats");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(enumfn)) {
+        PyErr_SetString(YappiProfileError, "enum function must be callable");
+        return NULL;
+    }
+
+    _flush_deferred();
+    PyErr_Clear();
+    henum(pits, _pitenumgen, enumfn);
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_pitenumcold(_hitem *item, void *arg)
+{
+    _pit *pt;
+    char *fname;
+    PyObject *r;
+
+    pt = (_pit *)item->val;
+    if (!pt->ncold)
+        return 0;
+    if ((!flags.builtins) && (pt->builtin))
+        return 0;
+
+    fname = _item2fname(pt);
+    if (!fname)
+        fname = "N/A";
+
+    // the steady calls are the sampled ones, the average is taken over them.
+    r = PyObject_CallFunction((PyObject *)arg, "((sfIfkf))", fname,
+                              pt->tfirst * tickfactor(), pt->ncold,
+                              pt->tcold * tickfactor() / pt->ncold, pt->nsteady,
+                              pt->nsteady ? pt->tsteady * tickfactor() / pt->nsteady : 0.0);
+    if (!r)
+        return 1;
+    Py_DECREF(r);
+    return 0;
+}
+
+static PyObject*
+enum_cold_stats(PyObject *self, PyObject *args)
+{
+    PyObject *enumfn;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        return NULL;
+    }
+
+    if (!PyArg_ParseTuple(args, "O", &enumfn)) {
+        PyErr_SetString(YappiProfileError, "invalid param to enum_cold_stats");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(enumfn)) {
+        PyErr_SetString(YappiProfileError, "enum function must be callable");
+        return NULL;
+    }
+
+    _flush_deferred();
+    PyErr_Clear();
+    henum(pits, _pitenumcold, enumfn);
+    if (PyErr_Occurred())
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int
+_pitenumslow(_hitem *item, void *arg)
+{
+    _pit *pt;
+    PyObject *v;
+
+    pt = (_pit *)item->val;
+    v = _pit_lookup(pt, slowfilter);
+    if (v)
+        pt->slow_threshold = PyLong_AsLongLong(v);
+    return 0;
+}
+
+static PyObject*
+set_slow_threshold(PyObject *self, PyObject *args)
+{
+    double threshold;
+    long long ticks;
+    PyObject *names, *v;
+
+    names = NULL;
+    if (!PyArg_ParseTuple(args, "d|O", &threshold, &names))
+        return NULL;
+
+    if (threshold < 0) {
+        PyErr_SetString(YappiProfileError, "slow call threshold cannot be negative.");
+        return NULL;
+    }
+    ticks = (long long)(threshold / tickfactor());
+    if ((threshold > 0) && (ticks == 0))
+        ticks = 1;
+
+    if (!names || names == Py_None) {
+        slow_threshold = ticks;
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    if (!slowfilter) {
+        slowfilter = PyDict_New();
+        if (!slowfilter)
+            return NULL;
+    }
+    v = PyLong_FromLongLong(ticks);
+    if (!v)
+        return NULL;
+    if (_names2dict(slowfilter, names, v) < 0) {
+        Py_DECREF(v);
+        return NULL;
+    }
+    Py_DECREF(v);
+
+    // apply the threshold to the functions that are already profiled.
+    if (yappinitialized)
+        henum(pits, _pitenumslow, NULL);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+get_slow_calls(PyObject *self, PyObject *args)
+{
+    int i, j, n;
+    char *fname;
+    _slowcall *sc, *scs;
+    PyObject *li, *stack, *it;
+
+    li = NULL;
+    scs = NULL;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+        goto err;
+    }
+
+    // take a copy of the ring, the aggregator may add to it in deferred mode.
+    _flush_deferred();
+    if (flags.deferred)
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+    n = rcount(slowcalls);
+    scs = (_slowcall *)ytmalloc((n ? n : 1) * sizeof(_slowcall), YMEM_STATS);
+    if (scs) {
+        for(i=0; i<n; i++)
+            memcpy(&scs[i], rget(slowcalls, i), sizeof(_slowcall));
+    }
+    if (flags.deferred)
+        PyThread_release_lock(agglock);
+    if (!scs) {
+        PyErr_NoMemory();
+        goto err;
+    }
+
+    li = PyList_New(0);
+    if (!li)
+        goto err;
+
+    for(i=0; i<n; i++) {
+        sc = &scs[i];
+        stack = PyList_New(sc->nframes);
+        if (!stack)
+            goto err;
+        for(j=0; j<sc->nframes; j++) {
+            fname = _item2fname(sc->frames[j]);
+            if (!fname)
+                fname = "N/A";
+            it = PyString_FromString(fname);
+            if (!it) {
+                Py_DECREF(stack);
+                goto err;
+            }
+            PyList_SET_ITEM(stack, j, it);
+        }
+        it = Py_BuildValue("(lOddiN)", sc->tid, PyList_GET_ITEM(stack, sc->nframes-1),
+                           sc->tstart, sc->elapsed * tickfactor(), sc->depth, stack);
+        if (!it)
+            goto err;
+        if (PyList_Append(li, it) < 0) {
+            Py_DECREF(it);
+            goto err;
+        }
+        Py_DECREF(it);
+    }
+
+    yfree(scs);
+    return li;
+err:
+    if (scs)
+        yfree(scs);
+    Py_XDECREF(li);
+    return NULL;
+}
+
+static int
+_pitenumdump(_hitem *item, void *arg)
+{
+    _pit *pt;
+    PyObject *name;
+    long long cumdiff;
+    double tf;
+
+    pt = (_pit *)item->val;
+
+    // do not save builtins if specified in yappi.start(..)
+    if  ((!flags.builtins) && (pt->builtin))
+        return 0;
+
+    name = _pit2ident(pt);
+    if (!name) {
+        PyErr_Clear();
+        dumperr = 1;
+        return 1;
+    }
+    cumdiff = _calc_cumdiff(pt->ttotal, pt->tsubtotal);
+    tf = tickfactor() * flags.timing_sample;
+    if (!dumpaddpit((_dump *)arg, PyString_AS_STRING(name), pt->builtin, pt->callcount,
+                    pt->ttotal * tf, cumdiff * tf))
+        dumperr = 1;
+    Py_DECREF(name);
+    return dumperr;
+}
+
+static int
+_ctxenumdump(_hitem *item, void *arg)
+{
+    _ctx *ctx;
+    char *tcname;
+
+    ctx = (_ctx *)item->val;
+    tcname = ctx->class_name;
+    if (tcname == NULL)
+        tcname = "N/A";
+    if (!dumpaddctx((_dump *)arg, ctx->id, tcname, ctx->sched_cnt, ctx->ttotal * tickfactor()))
+        dumperr = 1;
+    return dumperr;
+}
+
+// snapshots the current profile into a dump.
+static _dump *
+_profile2dump(void)
+{
+    _dump *d;
+
+    d = dumpcreate();
+    if (!d)
+        return NULL;
+    d->tstart = yappstarttime;
+    d->nmerged = 1;
+
+    dumperr = 0;
+    henum(pits, _pitenumdump, d);
+    if (!dumperr)
+        henum(contexts, _ctxenumdump, d);
+    if (!dumperr && retiredcnt &&
+            !dumpaddctx(d, 0, "retired", retiredsched, retiredttotal * tickfactor()))
+        dumperr = 1;
+    if (dumperr) {
+        dumpdestroy(d);
+        return NULL;
+    }
+    return d;
+}
+
+// streams a pit into a marshalled pstats dict as a
+// (filename, line, name) -> (cc, nc, tt, ct, callers) item. Callers are
+// left empty as caller edges are not recorded.
+static int
+_pitenumpstat(_hitem *item, void *arg)
+{
+    _pit *pt;
+    PyCodeObject *co;
+    PyObject *key, *val;
+    long long cumdiff;
+    double tf;
+
+    pt = (_pit *)item->val;
+    if  ((!flags.builtins) && (pt->builtin))
+        return 0;
+
+    // tagged pits are told apart by the tag after the function name.
+    if (PyCode_Check(pt->co)) {
+        co = (PyCodeObject *)pt->co;
+        Py_INCREF(co->co_name);
+        key = Py_BuildValue("(OiN)", co->co_filename, co->co_firstlineno,
+                            _add_tag(co->co_name, pt));
+    } else {
+        Py_INCREF(pt->co);
+        key = Py_BuildValue("(siN)", "~", 0, _add_tag(pt->co, pt));
+    }
+    cumdiff = _calc_cumdiff(pt->ttotal, pt->tsubtotal);
+    tf = tickfactor() * flags.timing_sample;
+    val = Py_BuildValue("(kkdd{})", pt->callcount, pt->callcount, cumdiff * tf,
+                        pt->ttotal * tf);
+    if (!key || !val) {
+        Py_XDECREF(key);
+        Py_XDECREF(val);
+        PyErr_Clear();
+        dumperr = 1;
+        return 1;
+    }
+    // version 0 does not emit string references, which are only valid in
+    // the scope of a single write call.
+    PyMarshal_WriteObjectToFile(key, (FILE *)arg, 0);
+    PyMarshal_WriteObjectToFile(val, (FILE *)arg, 0);
+    Py_DECREF(key);
+    Py_DECREF(val);
+    return 0;
+}
+
+// streams a pit into a callgrind profile with its own time as the cost.
+static int
+_pitenumcallgrind(_hitem *item, void *arg)
 {
-    _del_pit((_pit *)item->val);
-    return 0;
-}
+    _pit *pt;
+    PyCodeObject *co;
+    PyObject *tag;
+    FILE *f;
+    long long cumdiff;
 
-static int
-_ctxenumdel(_hitem *item, void *arg)
-{
-    _del_ctx(((_ctx *)item->val) );
+    pt = (_pit *)item->val;
+    if  ((!flags.builtins) && (pt->builtin))
+        return 0;
+
+    tag = pt->tag ? PyObject_Str(pt->tag->name) : NULL;
+    if (pt->tag && !tag) {
+        PyErr_Clear();
+        dumperr = 1;
+        return 1;
+    }
+    f = (FILE *)arg;
+    cumdiff = _calc_cumdiff(pt->ttotal, pt->tsubtotal);
+    if (PyCode_Check(pt->co)) {
+        co = (PyCodeObject *)pt->co;
+        fprintf(f, "fl=%s\nfn=%s:%d", PyString_AS_STRING(co->co_filename),
+                PyString_AS_STRING(co->co_name), co->co_firstlineno);
+    } else {
+        fprintf(f, "fl=~\nfn=%s", PyString_AS_STRING(pt->co));
+    }
+    if (tag)
+        fprintf(f, " [%s]", PyString_AS_STRING(tag));
+    Py_XDECREF(tag);
+    fprintf(f, "\n%d", PyCode_Check(pt->co) ? ((PyCodeObject *)pt->co)->co_firstlineno : 0);
+    fprintf(f, " %lld\n\n", (long long)(cumdiff * tickfactor() * flags.timing_sample * 1000000));
     return 0;
 }
 
 static int
-_ctxenumstat(_hitem *item, void *arg)
+_save_stream(char *path, char *type)
 {
-    char *fname, *tcname;
-    _ctx * ctx;
-    char temp[LINE_LEN];
-    PyObject *buf;
-
-    ctx = (_ctx *)item->val;
-
-    fname = _item2fname(ctx->last_pit);
-    if (!fname)
-        fname = "N/A";
-
-    memset(temp, 0, LINE_LEN);
+    FILE *f;
+    int rc;
 
-    tcname = ctx->class_name;
-    if (tcname == NULL)
-        tcname = "N/A";
+    f = fopen(path, "wb");
+    if (!f)
+        return 0;
 
-    _yformat_string(tcname, temp, THREAD_NAME_LEN);
-    _yformat_long(ctx->id, temp);
-    _yformat_string(fname, temp, FUNC_NAME_LEN);
-    _yformat_ulong(ctx->sched_cnt, temp);
-    _yformat_double(ctx->ttotal * tickfactor(), temp);
+    dumperr = 0;
+    if (strcmp(type, "pstat") == 0) {
+        fputc('{', f);
+        henum(pits, _pitenumpstat, f);
+        fputc('0', f);
+    } else {
+        fprintf(f, "version: 1\ncreator: yappi\npositions: line\nevents: Microseconds\n\n");
+        henum(pits, _pitenumcallgrind, f);
+    }
 
+    rc = !dumperr && !ferror(f);
+    if (fclose(f) != 0)
+        rc = 0;
+    return rc;
+}
 
-    buf = PyString_FromString(temp);
-    if (!buf)
-        return 0; // just continue.
+// writes the current profile to path in the given format.
+static int
+_save_profile(char *path, char *type)
+{
+    _dump *d;
+    int rc;
 
-    if (PyList_Append((PyObject *)arg, buf) < 0)
-        return 0; // just continue.
+    if (strcmp(type, "ystat") != 0)
+        return _save_stream(path, type);
 
-    return 0;
+    d = _profile2dump();
+    if (!d)
+        return 0;
+    rc = dumpwrite(d, path);
+    dumpdestroy(d);
+    return rc;
 }
 
-static PyObject*
-stop(PyObject *self, PyObject *args)
+static int
+_check_profile_type(char *type)
 {
-    if (!yapprunning) {
-        PyErr_SetString(YappiProfileError, "profiler is not started yet.");
-        return NULL;
+    if (strcmp(type, "ystat") != 0 && strcmp(type, "pstat") != 0 &&
+            strcmp(type, "callgrind") != 0) {
+        PyErr_Format(YappiProfileError, "unknown profile type %s.", type);
+        return 0;
     }
-
-    _enum_threads(&_unprofile_thread);
-
-    yapprunning = 0;
-    yappstoptick = tickcount();
-
-    Py_INCREF(Py_None);
-    return Py_None;
+    return 1;
 }
 
 static PyObject*
-clear_stats(PyObject *self, PyObject *args)
+save(PyObject *self, PyObject *args)
 {
-    if (yapprunning) {
-        PyErr_SetString(YappiProfileError,
-                        "profiler is running. Stop profiler before clearing stats.");
+    char *path, *type;
+
+    if (!yapphavestats) {
+        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
         return NULL;
     }
 
-    henum(pits, _pitenumdel, NULL);
-    htdestroy(pits);
-    henum(contexts, _ctxenumdel, NULL);
-    htdestroy(contexts);
+    type = "ystat";
+    if (!PyArg_ParseTuple(args, "s|s", &path, &type))
+        return NULL;
 
-    fldestroy(flpit);
-    fldestroy(flctx);
-    yappinitialized = 0;
-    yapphavestats = 0;
+    if (!_check_profile_type(type))
+        return NULL;
 
-// check for mem leaks if DEBUG_MEM is specified
-#ifdef DEBUG_MEM
-    YMEMLEAKCHECK();
-#endif
+    _flush_deferred();
+    if (!_save_profile(path, type)) {
+        PyErr_Format(YappiProfileError, "profile cannot be written to %s.", path);
+        return NULL;
+    }
 
     Py_INCREF(Py_None);
     return Py_None;
 }
 
 static PyObject*
-get_stats(PyObject *self, PyObject *args)
+load(PyObject *self, PyObject *args)
 {
+    int i;
+    char *path;
+    _dump *d;
+    PyObject *funcs, *threads, *it;
 
-    char *prof_state,*timestr;
-    _statnode *p;
-    PyObject *buf,*li;
-    int type, order, limit, fcnt;
-    char temp[LINE_LEN];
-    long long appttotal;
+    funcs = threads = NULL;
 
-    li = buf = NULL;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
 
-    if (!yapphavestats) {
-        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
-        goto err;
+    d = dumpread(path);
+    if (!d) {
+        PyErr_Format(YappiProfileError, "%s is not a valid yappi profile.", path);
+        return NULL;
     }
 
-    if (!PyArg_ParseTuple(args, "iii", &type, &order, &limit)) {
-        PyErr_SetString(YappiProfileError, "invalid param to get_stats");
-        goto err;
-    }
-    // sorttype/order/limit is in valid bounds?
-    if ((type < 0) || (type > STAT_SORT_TYPE_MAX)) {
-        PyErr_SetString(YappiProfileError, "sorttype param for get_stats is out of bounds");
-        goto err;
-    }
-    if ((order < 0) || (order > STAT_SORT_ORDER_MAX)) {
-        PyErr_SetString(YappiProfileError, "sortorder param for get_stats is out of bounds");
+    funcs = PyList_New(0);
+    threads = PyList_New(0);
+    if (!funcs || !threads)
         goto err;
+    for(i=0; i<d->npits; i++) {
+        it = Py_BuildValue("(sKdd)", d->strings[d->pits[i].name], d->pits[i].callcount,
+                           d->pits[i].ttot, d->pits[i].tsub);
+        if (!it || PyList_Append(funcs, it) < 0) {
+            Py_XDECREF(it);
+            goto err;
+        }
+        Py_DECREF(it);
     }
-    if (limit < STAT_SHOW_ALL) {
-        PyErr_SetString(YappiProfileError, "limit param for get_stats is out of bounds");
-        goto err;
+    for(i=0; i<d->nctxs; i++) {
+        it = Py_BuildValue("(sLKd)", d->strings[d->ctxs[i].name], d->ctxs[i].tid,
+                           d->ctxs[i].sched_cnt, d->ctxs[i].ttot);
+        if (!it || PyList_Append(threads, it) < 0) {
+            Py_XDECREF(it);
+            goto err;
+        }
+        Py_DECREF(it);
     }
+    dumpdestroy(d);
+    return Py_BuildValue("(NN)", funcs, threads);
 
+err:
+    dumpdestroy(d);
+    Py_XDECREF(funcs);
+    Py_XDECREF(threads);
+    return NULL;
+}
 
+static PyObject*
+merge(PyObject *self, PyObject *args)
+{
+    int i;
+    char *path, *src;
+    PyObject *paths;
+    _dump *d, *sd;
 
-    // enum and present stats in a linked list.(statshead)
-    henum(pits, _pitenumstat2, (void *)type);
-    _order_stats_internal(order);
+    if (!PyArg_ParseTuple(args, "Os", &paths, &path))
+        return NULL;
 
-    li = PyList_New(0);
-    if (!li)
-        goto err;
-    if (PyList_Append(li, PyString_FromString(STAT_HEADER_STR)) < 0)
-        goto err;
+    paths = PySequence_Fast(paths, "paths must be a list.");
+    if (!paths)
+        return NULL;
 
-    fcnt = 0;
-    p = statshead;
-    while(p) {
-        // limit reached?
-        if (limit != STAT_SHOW_ALL) {
-            if (fcnt == limit)
-                break;
-        }
-        buf = PyString_FromString(p->it->result);
-        if (!buf)
+    d = dumpcreate();
+    if (!d) {
+        Py_DECREF(paths);
+        return PyErr_NoMemory();
+    }
+
+    for(i=0; i<PySequence_Fast_GET_SIZE(paths); i++) {
+        src = PyString_AsString(PySequence_Fast_GET_ITEM(paths, i));
+        if (!src)
             goto err;
-        if (PyList_Append(li, buf) < 0)
+        sd = dumpread(src);
+        if (!sd) {
+            PyErr_Format(YappiProfileError, "%s is not a valid yappi profile.", src);
             goto err;
-
-        Py_DECREF(buf);
-        fcnt++;
-        p = p->next;
+        }
+        if (!dumpmerge(d, sd)) {
+            dumpdestroy(sd);
+            PyErr_NoMemory();
+            goto err;
+        }
+        dumpdestroy(sd);
     }
 
-    if (PyList_Append(li, PyString_FromString(STAT_FOOTER_STR)) < 0)
+    if (!dumpwrite(d, path)) {
+        PyErr_Format(YappiProfileError, "profile cannot be written to %s.", path);
         goto err;
+    }
+    dumpdestroy(d);
+    Py_DECREF(paths);
 
-    henum(contexts, _ctxenumstat, (void *)li);
+    Py_INCREF(Py_None);
+    return Py_None;
 
-    if (PyList_Append(li, PyString_FromString(STAT_FOOTER_STR2)) < 0)
-        goto err;
+err:
+    dumpdestroy(d);
+    Py_DECREF(paths);
+    return NULL;
+}
 
-    if (yapprunning) {
-        appttotal = tickcount()-yappstarttick;
-        prof_state = "running";
-    } else {
-        appttotal = yappstoptick - yappstarttick;
-        prof_state = "stopped";
-    }
+static int
+_pitenumreset(_hitem *item, void *arg)
+{
+    _pit *pt;
 
-    memset(temp, 0, LINE_LEN);
-    _yformat_string(prof_state, temp, DOUBLE_COLUMN_LEN);
+    pt = (_pit *)item->val;
+    pt->callcount = 0;
+    pt->ttotal = 0;
+    pt->tsubtotal = 0;
+    pt->resumes = 0;
+    pt->nlife = 0;
+    pt->tlife = 0;
+    pt->ncold = 0;
+    pt->tfirst = 0;
+    pt->tcold = 0;
+    pt->nsteady = 0;
+    pt->tsteady = 0;
+    if (pt->hist)
+        histclear(pt->hist);
+    if (pt->lines)
+        memset(pt->lines->lines, 0, pt->lines->count * sizeof(_linestat));
+    return 0;
+}
 
-    // FIX: Issue #13.
-    // ctime() string is a static allocated block of char and it is followed by a '\n'
-    // char let's exclude it. See:
-    // http://www.cplusplus.com/reference/clibrary/ctime/ctime/
-    timestr = ctime(&yappstarttime);
-    timestr[strlen(timestr)-1] = '\0';
+static int
+_ctxenumreset(_hitem *item, void *arg)
+{
+    _ctx *ctx;
 
-    _yformat_string(timestr, temp, TIMESTR_COLUMN_LEN);
-    _yformat_int(hcount(pits), temp);
-    _yformat_int(hcount(contexts), temp);
-    _yformat_ulong(ymemusage(), temp);
+    ctx = (_ctx *)item->val;
+    ctx->sched_cnt = 0;
+    ctx->ttotal = 0;
+    return 0;
+}
 
-    if (PyList_Append(li, PyString_FromString(temp)) < 0)
-        goto err;
+// zeroes the counters without stopping the profiler, the stats start over
+// from now on. Calls that are active at the moment still count their time
+// from the beginning of the call when they return.
+static void
+_reset_stats(void)
+{
+    if (flags.deferred)
+        PyThread_acquire_lock(agglock, WAIT_LOCK);
+    henum(pits, _pitenumreset, NULL);
+    henum(contexts, _ctxenumreset, NULL);
+    if (slowcalls)
+        rclear(slowcalls);
+    if (flags.deferred)
+        PyThread_release_lock(agglock);
+    retiredcnt = retiredsched = 0;
+    retiredttotal = 0;
+    retiredichits = retiredicmisses = 0;
+    time (&yappstarttime);
+    yappstarttick = tickcount();
+}
 
-    // clear the internal pit stat items that are generated temporarily.
-    _clear_stats_internal();
+// removes the oldest profiles until the written ones fit into the disk
+// budget. The newest profile is always kept.
+static void
+_agent_rotate(char *path)
+{
+    struct stat st;
+    PyObject *it;
 
-    return li;
-err:
-    _clear_stats_internal();
-    Py_XDECREF(li);
-    Py_XDECREF(buf);
-    return NULL;
+    if (stat(path, &st) != 0)
+        return;
+    it = Py_BuildValue("(sL)", path, (long long)st.st_size);
+    if (!it || PyList_Append(agentfiles, it) < 0) {
+        Py_XDECREF(it);
+        PyErr_Clear();
+        return;
+    }
+    Py_DECREF(it);
+    agentbytes += st.st_size;
+
+    while (agentbytes > agentmaxbytes && PyList_GET_SIZE(agentfiles) > 1) {
+        it = PyList_GET_ITEM(agentfiles, 0);
+        if (remove(PyString_AS_STRING(PyTuple_GET_ITEM(it, 0))) != 0)
+            yerr("profile cannot be removed.(%s)", PyString_AS_STRING(PyTuple_GET_ITEM(it, 0)));
+        agentbytes -= PyLong_AsLongLong(PyTuple_GET_ITEM(it, 1));
+        PySequence_DelItem(agentfiles, 0);
+    }
+}
+
+// writes the profile of the last interval, called with the GIL held.
+static void
+_agent_snapshot(void)
+{
+    char path[AGENT_PATH_LEN], ts[32];
+    time_t now;
+
+    if (!yapphavestats)
+        return;
+
+    now = time(NULL);
+    strftime(ts, sizeof(ts), "%Y%m%d-%H%M%S", localtime(&now));
+    PyOS_snprintf(path, sizeof(path), "%s.%s.%u.%s", PyString_AS_STRING(agentprefix), ts,
+                  agentseq++, agenttype);
+
+    _flush_deferred();
+    if (!_save_profile(path, agenttype)) {
+        yerr("profile cannot be written to %s.", path);
+        return;
+    }
+    if (agentreset)
+        _reset_stats();
+    _agent_rotate(path);
+}
+
+// the agent thread. It sleeps without the GIL and takes it only to write a
+// profile every agentinterval secs.
+static void
+_agent(void *arg)
+{
+    long long last;
+    PyGILState_STATE gs;
+
+    last = tickcount();
+    while (agentrunning) {
+        ysleep(AGENT_POLL_INTERVAL);
+        if ((tickcount() - last) * tickfactor() < agentinterval)
+            continue;
+        last = tickcount();
+        gs = PyGILState_Ensure();
+        if (agentrunning)
+            _agent_snapshot();
+        PyGILState_Release(gs);
+    }
+    PyThread_release_lock(agentexit);
 }
 
 static PyObject*
-enum_stats(PyObject *self, PyObject *args)
+start_agent(PyObject *self, PyObject *args)
 {
-    PyObject *enumfn;
+    PyObject *prefix;
 
-    if (!yapphavestats) {
-        PyErr_SetString(YappiProfileError, "profiler do not have any statistics. not started?");
+    if (agentrunning) {
+        PyErr_SetString(YappiProfileError, "agent is already started.");
         return NULL;
     }
 
-    if (!PyArg_ParseTuple(args, "O", &enumfn)) {
-        PyErr_SetString(YappiProfileError, "invalid param to enum_stats");
+    agenttype = "ystat";
+    agentreset = 1;
+    if (!PyArg_ParseTuple(args, "SdL|si", &prefix, &agentinterval, &agentmaxbytes,
+                          &agenttype, &agentreset))
+        return NULL;
+    if (!_check_profile_type(agenttype))
+        return NULL;
+    if (agentinterval <= 0) {
+        PyErr_SetString(YappiProfileError, "agent interval must be positive.");
         return NULL;
     }
 
-    if (!PyCallable_Check(enumfn)) {
-        PyErr_SetString(YappiProfileError, "enum function must be callable");
+    // the thread may outlive the args tuple.
+    if (strcmp(agenttype, "pstat") == 0)
+        agenttype = "pstat";
+    else if (strcmp(agenttype, "callgrind") == 0)
+        agenttype = "callgrind";
+    else
+        agenttype = "ystat";
+
+    Py_CLEAR(agentfiles);
+    agentfiles = PyList_New(0);
+    if (!agentfiles)
+        return NULL;
+    Py_INCREF(prefix);
+    Py_XDECREF(agentprefix);
+    agentprefix = prefix;
+    agentbytes = 0;
+    agentseq = 0;
+
+    // the thread state of the agent thread is created by PyGILState_Ensure.
+    PyEval_InitThreads();
+    agentrunning = 1;
+    PyThread_acquire_lock(agentexit, WAIT_LOCK);
+    if (PyThread_start_new_thread(_agent, NULL) == -1) {
+        PyThread_release_lock(agentexit);
+        agentrunning = 0;
+        PyErr_SetString(YappiProfileError, "agent thread cannot be started.");
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+stop_agent(PyObject *self, PyObject *args)
+{
+    if (!agentrunning) {
+        PyErr_SetString(YappiProfileError, "agent is not started yet.");
         return NULL;
     }
 
-    henum(pits, _pitenumstat, enumfn);
+    agentrunning = 0;
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(agentexit, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock(agentexit);
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -1114,7 +4022,24 @@ static PyMethodDef yappi_methods[] = {
     {"stop", stop, METH_VARARGS, NULL},
     {"get_stats", get_stats, METH_VARARGS, NULL},
     {"enum_stats", enum_stats, METH_VARARGS, NULL},
+    {"enum_latency_stats", enum_latency_stats, METH_VARARGS, NULL},
+    {"enum_line_stats", enum_line_stats, METH_VARARGS, NULL},
+    {"enum_generator_stats", enum_generator_stats, METH_VARARGS, NULL},
+    {"enum_cold_stats", enum_cold_stats, METH_VARARGS, NULL},
+    {"set_slow_threshold", set_slow_threshold, METH_VARARGS, NULL},
+    {"get_slow_calls", get_slow_calls, METH_VARARGS, NULL},
+    {"save", save, METH_VARARGS, NULL},
+    {"load", load, METH_VARARGS, NULL},
+    {"merge", merge, METH_VARARGS, NULL},
     {"clear_stats", clear_stats, METH_VARARGS, NULL},
+    {"is_running", is_running, METH_VARARGS, NULL},
+    {"set_tag", set_tag, METH_VARARGS, NULL},
+    {"set_context_id_callback", set_context_id_callback, METH_VARARGS, NULL},
+    {"get_mem_stats", get_mem_stats, METH_VARARGS, NULL},
+    {"get_icache_stats", get_icache_stats, METH_VARARGS, NULL},
+    {"get_profiler_stats", get_profiler_stats, METH_VARARGS, NULL},
+    {"start_agent", start_agent, METH_VARARGS, NULL},
+    {"stop_agent", stop_agent, METH_VARARGS, NULL},
     {"profile_event", profile_event, METH_VARARGS, NULL}, // for internal usage. do not call this.
     {NULL, NULL}      /* sentinel */
 };
@@ -1146,6 +4071,25 @@ init_yappi(void)
     yappinitialized = 0;
     yapphavestats = 0;
     yapprunning = 0;
+    histfilter = NULL;
+    slowfilter = NULL;
+    linefilter = NULL;
+    slow_threshold = 0;
+    tracedir = NULL;
+    tracenames = NULL;
+    pitcount = 0;
+    aggrunning = 0;
+    agentrunning = 0;
+    agentprefix = NULL;
+    agentfiles = NULL;
+    htsetclock(tickcount);
+    agglock = PyThread_allocate_lock();
+    aggexit = PyThread_allocate_lock();
+    agentexit = PyThread_allocate_lock();
+    if (!agglock || !aggexit || !agentexit) {
+        PyErr_SetString(YappiProfileError, "profiler cannot be initialized.");
+        return;
+    }
 
     if (!_init_profiler()) {
         PyErr_SetString(YappiProfileError, "profiler cannot be initialized.");
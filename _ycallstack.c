@@ -1,7 +1,6 @@
 #include "_ycallstack.h"
 #include "_ydebug.h"
 #include "_ymem.h"
-#include "_ytiming.h"
 #include "_ystatic.h"
 
 int
@@ -16,10 +15,10 @@ screate(int size)
     int i;
     _cstack *cs;
 
-    cs = (_cstack *)ymalloc(sizeof(_cstack));
+    cs = (_cstack *)ytmalloc(sizeof(_cstack), YMEM_CSTACK);
     if (!cs)
         return NULL;
-    cs->_items = ymalloc(size * sizeof(_cstackitem));
+    cs->_items = ytmalloc(size * sizeof(_cstackitem), YMEM_CSTACK);
     if (cs->_items == NULL) {
         yfree(cs);
         return NULL;
@@ -34,10 +33,12 @@ screate(int size)
     for(i=0; i<size; i++) {
         cs->_items[i].ckey = 0;
         cs->_items[i].t0 = 0;
+        cs->_items[i].cold = 0;
     }
 
     cs->size = size;
     cs->head = -1;
+    cs->grows = 0;
     return cs;
 }
 
@@ -54,10 +55,12 @@ _sgrow(_cstack * cs)
     for(i=0; i<cs->size; i++) {
         dummy->_items[i].ckey = cs->_items[i].ckey;
         dummy->_items[i].t0 = cs->_items[i].t0;
+        dummy->_items[i].cold = cs->_items[i].cold;
     }
     yfree(cs->_items);
     cs->_items = dummy->_items;
     cs->size = dummy->size;
+    cs->grows++;
     htdestroy(dummy->_counts);
     yfree(dummy);
     return 1;
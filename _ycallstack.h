@@ -6,6 +6,7 @@
 typedef struct {
     long long t0;
     void *ckey;
+    int cold; // one of the first calls of the function, timed apart.
 } _cstackitem;
 
 typedef struct {
@@ -13,6 +14,7 @@ typedef struct {
     int size;
     _cstackitem *_items;
     _htab *_counts;	// holds the number of same items in the cs.
+    unsigned long grows;
 } _cstack;
 
 _cstack *screate(int size);
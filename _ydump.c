@@ -0,0 +1,388 @@
+/*
+*    Binary profile dump
+*/
+
+#include "_ydump.h"
+#include "_ymem.h"
+#include "_ystatic.h"
+#include <string.h>
+
+#define DUMP_INIT_SIZE 64
+
+static unsigned int
+_strhash(const char *s)
+{
+    unsigned int h;
+
+    h = 5381;
+    while(*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h & 0x7FFFFFFF;
+}
+
+// doubles the given array if it is full.
+static int
+_dgrow(void **items, int *size, int count, int itemsize)
+{
+    void *p;
+
+    if (count < *size)
+        return 1;
+    p = ytmalloc(*size * 2 * itemsize, YMEM_STATS);
+    if (!p)
+        return 0;
+    memcpy(p, *items, count * itemsize);
+    yfree(*items);
+    *items = p;
+    *size = *size * 2;
+    return 1;
+}
+
+_dump *
+dumpcreate(void)
+{
+    _dump *d;
+
+    d = (_dump *)ytmalloc(sizeof(_dump), YMEM_STATS);
+    if (!d)
+        return NULL;
+    memset(d, 0, sizeof(_dump));
+    d->_strsize = d->_pitsize = d->_ctxsize = DUMP_INIT_SIZE;
+    d->strings = ytmalloc(d->_strsize * sizeof(char *), YMEM_STATS);
+    d->pits = ytmalloc(d->_pitsize * sizeof(_dumppit), YMEM_STATS);
+    d->ctxs = ytmalloc(d->_ctxsize * sizeof(_dumpctx), YMEM_STATS);
+    d->_names = htcreate(HT_DUMP_SIZE);
+    d->_pitidx = htcreate(HT_DUMP_SIZE);
+    if (!d->strings || !d->pits || !d->ctxs || !d->_names || !d->_pitidx) {
+        dumpdestroy(d);
+        return NULL;
+    }
+    return d;
+}
+
+void
+dumpdestroy(_dump *d)
+{
+    int i;
+
+    for(i=0; i<d->nstrings; i++)
+        yfree(d->strings[i]);
+    if (d->strings)
+        yfree(d->strings);
+    if (d->pits)
+        yfree(d->pits);
+    if (d->ctxs)
+        yfree(d->ctxs);
+    if (d->_names)
+        htdestroy(d->_names);
+    if (d->_pitidx)
+        htdestroy(d->_pitidx);
+    yfree(d);
+}
+
+// returns the index of the string in the string table, the string is added
+// if it is not there yet. -1 is returned on error.
+static int
+_dumpstr(_dump *d, const char *s)
+{
+    unsigned int key;
+    _hitem *it;
+    char *c;
+    size_t len;
+
+    // strings with colliding hashes are stored on the next free key.
+    for(key=_strhash(s); ; key=(key+1) & 0x7FFFFFFF) {
+        it = hfind(d->_names, key);
+        if (!it)
+            break;
+        if (strcmp(d->strings[it->val], s) == 0)
+            return (int)it->val;
+    }
+
+    if (!_dgrow((void **)&d->strings, &d->_strsize, d->nstrings, sizeof(char *)))
+        return -1;
+    len = strlen(s);
+    c = ytmalloc(len+1, YMEM_STATS);
+    if (!c)
+        return -1;
+    memcpy(c, s, len+1);
+    if (!hadd(d->_names, key, d->nstrings)) {
+        yfree(c);
+        return -1;
+    }
+    d->strings[d->nstrings] = c;
+    return d->nstrings++;
+}
+
+int
+dumpaddpit(_dump *d, const char *name, int builtin, unsigned long long callcount,
+           double ttot, double tsub)
+{
+    int s;
+    _hitem *it;
+    _dumppit *p;
+
+    s = _dumpstr(d, name);
+    if (s < 0)
+        return 0;
+
+    it = hfind(d->_pitidx, s);
+    if (it) {
+        p = &d->pits[it->val];
+        p->builtin |= builtin;
+        p->callcount += callcount;
+        p->ttot += ttot;
+        p->tsub += tsub;
+        return 1;
+    }
+
+    if (!_dgrow((void **)&d->pits, &d->_pitsize, d->npits, sizeof(_dumppit)))
+        return 0;
+    if (!hadd(d->_pitidx, s, d->npits))
+        return 0;
+    p = &d->pits[d->npits++];
+    p->name = s;
+    p->builtin = builtin;
+    p->callcount = callcount;
+    p->ttot = ttot;
+    p->tsub = tsub;
+    return 1;
+}
+
+int
+dumpaddctx(_dump *d, long long tid, const char *name, unsigned long long sched_cnt,
+           double ttot)
+{
+    int s;
+    _dumpctx *c;
+
+    s = _dumpstr(d, name);
+    if (s < 0)
+        return 0;
+    if (!_dgrow((void **)&d->ctxs, &d->_ctxsize, d->nctxs, sizeof(_dumpctx)))
+        return 0;
+    c = &d->ctxs[d->nctxs++];
+    c->tid = tid;
+    c->name = s;
+    c->sched_cnt = sched_cnt;
+    c->ttot = ttot;
+    return 1;
+}
+
+// adds up the pits of src into d by name. Contexts of different profiles
+// are different threads, they are appended.
+int
+dumpmerge(_dump *d, _dump *src)
+{
+    int i;
+    _dumppit *p;
+    _dumpctx *c;
+
+    for(i=0; i<src->npits; i++) {
+        p = &src->pits[i];
+        if (!dumpaddpit(d, src->strings[p->name], p->builtin, p->callcount,
+                        p->ttot, p->tsub))
+            return 0;
+    }
+    for(i=0; i<src->nctxs; i++) {
+        c = &src->ctxs[i];
+        if (!dumpaddctx(d, c->tid, src->strings[c->name], c->sched_cnt, c->ttot))
+            return 0;
+    }
+    if (!d->nmerged || (src->tstart && src->tstart < d->tstart))
+        d->tstart = src->tstart;
+    d->nmerged += src->nmerged;
+    return 1;
+}
+
+static void
+_put32(FILE *f, unsigned int v)
+{
+    unsigned char b[4];
+
+    b[0] = v & 0xFF;
+    b[1] = (v >> 8) & 0xFF;
+    b[2] = (v >> 16) & 0xFF;
+    b[3] = (v >> 24) & 0xFF;
+    fwrite(b, 1, 4, f);
+}
+
+static void
+_put64(FILE *f, unsigned long long v)
+{
+    _put32(f, (unsigned int)(v & 0xFFFFFFFF));
+    _put32(f, (unsigned int)(v >> 32));
+}
+
+static void
+_putdbl(FILE *f, double v)
+{
+    unsigned long long u;
+
+    memcpy(&u, &v, sizeof(u));
+    _put64(f, u);
+}
+
+static int
+_get32(FILE *f, unsigned int *v)
+{
+    unsigned char b[4];
+
+    if (fread(b, 1, 4, f) != 4)
+        return 0;
+    *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+    return 1;
+}
+
+static int
+_get64(FILE *f, unsigned long long *v)
+{
+    unsigned int lo, hi;
+
+    if (!_get32(f, &lo) || !_get32(f, &hi))
+        return 0;
+    *v = ((unsigned long long)hi << 32) | lo;
+    return 1;
+}
+
+static int
+_getdbl(FILE *f, double *v)
+{
+    unsigned long long u;
+
+    if (!_get64(f, &u))
+        return 0;
+    memcpy(v, &u, sizeof(u));
+    return 1;
+}
+
+int
+dumpwrite(_dump *d, const char *path)
+{
+    int i, rc;
+    size_t len;
+    FILE *f;
+
+    f = fopen(path, "wb");
+    if (!f)
+        return 0;
+
+    fwrite(DUMP_MAGIC, 1, 8, f);
+    _put32(f, DUMP_VERSION);
+    _put32(f, d->nmerged);
+    _put64(f, (unsigned long long)d->tstart);
+    _put32(f, d->nstrings);
+    _put32(f, d->npits);
+    _put32(f, d->nctxs);
+
+    for(i=0; i<d->nstrings; i++) {
+        len = strlen(d->strings[i]);
+        _put32(f, (unsigned int)len);
+        fwrite(d->strings[i], 1, len, f);
+    }
+    for(i=0; i<d->npits; i++) {
+        _put32(f, d->pits[i].name);
+        _put32(f, d->pits[i].builtin);
+        _put64(f, d->pits[i].callcount);
+        _putdbl(f, d->pits[i].ttot);
+        _putdbl(f, d->pits[i].tsub);
+    }
+    for(i=0; i<d->nctxs; i++) {
+        _put64(f, (unsigned long long)d->ctxs[i].tid);
+        _put32(f, d->ctxs[i].name);
+        _put32(f, 0);
+        _put64(f, d->ctxs[i].sched_cnt);
+        _putdbl(f, d->ctxs[i].ttot);
+    }
+
+    rc = !ferror(f);
+    if (fclose(f) != 0)
+        rc = 0;
+    return rc;
+}
+
+// reads the dump at path. NULL is returned if the file cannot be read or
+// is not a valid dump.
+_dump *
+dumpread(const char *path)
+{
+    FILE *f;
+    _dump *d;
+    char magic[8], *s;
+    int *smap;
+    unsigned int i, version, nmerged, nstrings, npits, nctxs, len, name, builtin, dummy;
+    unsigned long long tstart, callcount, tid, sched_cnt;
+    double ttot, tsub;
+
+    d = NULL;
+    s = NULL;
+    smap = NULL;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, DUMP_MAGIC, 8) != 0)
+        goto err;
+    if (!_get32(f, &version) || version != DUMP_VERSION)
+        goto err;
+    if (!_get32(f, &nmerged) || !_get64(f, &tstart) || !_get32(f, &nstrings) ||
+            !_get32(f, &npits) || !_get32(f, &nctxs))
+        goto err;
+
+    d = dumpcreate();
+    if (!d)
+        goto err;
+    d->tstart = (long long)tstart;
+    d->nmerged = nmerged;
+
+    // indexes of the strings in the file may differ from the ones in d if
+    // the file has duplicates.
+    smap = ytmalloc((nstrings ? nstrings : 1) * sizeof(int), YMEM_STATS);
+    s = ytmalloc(DUMP_MAX_STRLEN+1, YMEM_STATS);
+    if (!smap || !s)
+        goto err;
+    for(i=0; i<nstrings; i++) {
+        if (!_get32(f, &len) || len > DUMP_MAX_STRLEN)
+            goto err;
+        if (fread(s, 1, len, f) != len)
+            goto err;
+        s[len] = '\0';
+        smap[i] = _dumpstr(d, s);
+        if (smap[i] < 0)
+            goto err;
+    }
+    for(i=0; i<npits; i++) {
+        if (!_get32(f, &name) || !_get32(f, &builtin) || !_get64(f, &callcount) ||
+                !_getdbl(f, &ttot) || !_getdbl(f, &tsub))
+            goto err;
+        if (name >= nstrings)
+            goto err;
+        if (!dumpaddpit(d, d->strings[smap[name]], builtin, callcount, ttot, tsub))
+            goto err;
+    }
+    for(i=0; i<nctxs; i++) {
+        if (!_get64(f, &tid) || !_get32(f, &name) || !_get32(f, &dummy) ||
+                !_get64(f, &sched_cnt) || !_getdbl(f, &ttot))
+            goto err;
+        if (name >= nstrings)
+            goto err;
+        if (!dumpaddctx(d, (long long)tid, d->strings[smap[name]], sched_cnt, ttot))
+            goto err;
+    }
+
+    yfree(smap);
+    yfree(s);
+    fclose(f);
+    return d;
+
+err:
+    if (smap)
+        yfree(smap);
+    if (s)
+        yfree(s);
+    if (d)
+        dumpdestroy(d);
+    fclose(f);
+    return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef YDUMP_H
+#define YDUMP_H
+
+#include "_yhashtab.h"
+
+/*
+*    Binary profile dump
+*
+*    A dump is a string table of function identities and thread class
+*    names followed by fixed size pit and context records that refer to
+*    the strings by index. All integers are written little endian, so a
+*    dump can be merged on any host. Pits are unique by name; adding a
+*    pit with a known name adds up the counters, which is also how dumps
+*    are merged.
+*
+*    layout (version 1):
+*        char magic[8]            "YAPPIPRF"
+*        u32 version, u32 nmerged
+*        i64 tstart
+*        u32 nstrings, u32 npits, u32 nctxs
+*        nstrings * (u32 len, char[len])
+*        npits * (u32 name, u32 builtin, u64 callcount, f64 ttot, f64 tsub)
+*        nctxs * (i64 tid, u32 name, u32 reserved, u64 sched_cnt, f64 ttot)
+*/
+
+#define DUMP_MAGIC "YAPPIPRF"
+#define DUMP_VERSION 1
+#define DUMP_MAX_STRLEN 65535 // sanity limit for reading
+
+typedef struct {
+    unsigned int name;
+    unsigned int builtin;
+    unsigned long long callcount;
+    double ttot;
+    double tsub; // time spent in the function itself.
+} _dumppit;
+
+typedef struct {
+    long long tid;
+    unsigned int name; // class name of the thread
+    unsigned long long sched_cnt;
+    double ttot;
+} _dumpctx;
+
+typedef struct {
+    long long tstart;
+    unsigned int nmerged; // number of profiles merged into this one.
+    int nstrings;
+    int npits;
+    int nctxs;
+    char **strings;
+    _dumppit *pits;
+    _dumpctx *ctxs;
+    int _strsize;
+    int _pitsize;
+    int _ctxsize;
+    _htab *_names; // string hash -> string index
+    _htab *_pitidx; // string index -> pit index
+} _dump;
+
+_dump *dumpcreate(void);
+void dumpdestroy(_dump *d);
+int dumpaddpit(_dump *d, const char *name, int builtin, unsigned long long callcount,
+               double ttot, double tsub);
+int dumpaddctx(_dump *d, long long tid, const char *name, unsigned long long sched_cnt,
+               double ttot);
+int dumpmerge(_dump *d, _dump *src);
+int dumpwrite(_dump *d, const char *path);
+_dump *dumpread(const char *path);
+
+#endif
@@ -1,5 +1,37 @@
 #include "_yfreelist.h"
 #include "_ymem.h"
+#include "_ystatic.h"
+
+// allocates count chunks from a single cache line aligned slab, so that the
+// chunks are contiguous and a chunk never shares a cache line with another.
+static int
+_flslab(_freelist *flp, void **items, int count)
+{
+    int i;
+    char *slab, *base;
+    void **slabs;
+
+    slab = ytmalloc(count * flp->chunksize + YCACHELINE-1, flp->tag);
+    if (!slab)
+        return 0;
+    slabs = ytmalloc((flp->nslabs+1) * sizeof(void *), flp->tag);
+    if (!slabs) {
+        yfree(slab);
+        return 0;
+    }
+    for (i=0; i<flp->nslabs; i++)
+        slabs[i] = flp->slabs[i];
+    slabs[flp->nslabs] = slab;
+    if (flp->slabs)
+        yfree(flp->slabs);
+    flp->slabs = slabs;
+    flp->nslabs++;
+
+    base = (char *)(((uintptr_t)slab + YCACHELINE-1) & ~(uintptr_t)(YCACHELINE-1));
+    for (i=0; i<count; i++)
+        items[i] = base + i * flp->chunksize;
+    return 1;
+}
 
 static int
 _flgrow(_freelist *flp)
@@ -11,17 +43,17 @@ _flgrow(_freelist *flp)
 
     old = flp->items;
     newsize = flp->size * 2;
-    flp->items = ymalloc(newsize * sizeof(void *));
-    if (!flp->items)
+    flp->items = ytmalloc(newsize * sizeof(void *), flp->tag);
+    if (!flp->items) {
+        flp->items = old;
         return 0;
+    }
 
     // init new list
-    for(i=0; i<flp->size; i++) {
-        flp->items[i] = ymalloc(flp->chunksize);
-        if (!flp->items[i]) {
-            yfree(flp->items);
-            return 0;
-        }
+    if (!_flslab(flp, flp->items, flp->size)) {
+        yfree(flp->items);
+        flp->items = old;
+        return 0;
     }
     // copy old list
     for(i=flp->size; i<newsize; i++)
@@ -30,34 +62,35 @@ _flgrow(_freelist *flp)
     yfree(old);
     flp->head = flp->size-1;
     flp->size = newsize;
+    flp->grows++;
     return 1;
 }
 
 _freelist *
-flcreate(int chunksize, int size)
+flcreate(int chunksize, int size, int tag)
 {
-    int i;
     _freelist *flp;
 
-    flp = (_freelist *)ymalloc(sizeof(_freelist));
+    flp = (_freelist *)ytmalloc(sizeof(_freelist), tag);
     if (!flp)
         return NULL;
-    flp->items = ymalloc(size * sizeof(void *));
+    flp->tag = tag;
+    flp->items = ytmalloc(size * sizeof(void *), tag);
     if (!flp->items) {
         yfree(flp);
         return NULL;
     }
 
-    for (i=0; i<size; i++) {
-        flp->items[i] = ymalloc(chunksize);
-        if (!flp->items[i]) {
-            yfree(flp->items);
-            yfree(flp);
-            return NULL;
-        }
+    flp->slabs = NULL;
+    flp->nslabs = 0;
+    flp->grows = 0;
+    flp->chunksize = (chunksize + YCACHELINE-1) & ~(YCACHELINE-1);
+    if (!_flslab(flp, flp->items, size)) {
+        yfree(flp->items);
+        yfree(flp);
+        return NULL;
     }
     flp->size = size;
-    flp->chunksize = chunksize;
     flp->head = size-1;
     return flp;
 }
@@ -67,9 +100,10 @@ fldestroy(_freelist *flp)
 {
     int i;
 
-    for (i=0; i<flp->size; i++) {
-        yfree(flp->items[i]);
+    for (i=0; i<flp->nslabs; i++) {
+        yfree(flp->slabs[i]);
     }
+    yfree(flp->slabs);
     yfree(flp->items);
     yfree(flp);
 }
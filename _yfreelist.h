@@ -4,11 +4,15 @@
 typedef struct {
     int head;
     int size;
-    int chunksize;
+    int chunksize; // rounded up to a multiple of the cache line.
     void **items;
+    void **slabs; // the memory the chunks are carved from.
+    int nslabs;
+    unsigned long grows;
+    int tag; // memory accounting tag of the chunks, see _ymem.h
 } _freelist;
 
-_freelist * flcreate(int chunksize, int size);
+_freelist * flcreate(int chunksize, int size, int tag);
 void fldestroy(_freelist *flp);
 void *flget(_freelist *flp);
 int flput(_freelist *flp, void *p);
@@ -6,13 +6,24 @@
 #include "_yhashtab.h"
 #include "_ymem.h"
 
+static long long (*htclock)(void) = NULL;
+
+// sets the clock _hgrow() pauses are measured with.
+void
+htsetclock(long long (*fn)(void))
+{
+    htclock = fn;
+}
+
 static int
 _hgrow(_htab *ht)
 {
     int i;
+    long long t0;
     _htab *dummy;
     _hitem *p, *next, *it;
 
+    t0 = htclock ? htclock() : 0;
     dummy = htcreate(ht->logsize+1);
     if (!dummy)
         return 0;
@@ -38,6 +49,9 @@ _hgrow(_htab *ht)
     ht->realsize = dummy->realsize;
     ht->mask = dummy->mask;
     yfree(dummy);
+    ht->grows++;
+    if (htclock)
+        ht->growtime += htclock() - t0;
     return 1;
 }
 
@@ -47,7 +61,7 @@ htcreate(int logsize)
     int i;
     _htab *ht;
 
-    ht = (_htab *)ymalloc(sizeof(_htab));
+    ht = (_htab *)ytmalloc(sizeof(_htab), YMEM_HTAB);
     if (!ht)
         return NULL;
     ht->logsize = logsize;
@@ -55,7 +69,11 @@ htcreate(int logsize)
     ht->mask = HMASK(logsize);
     ht->count = 0;
     ht->freecount = 0;
-    ht->_table = (_hitem **)ymalloc(ht->realsize * sizeof(_hitem *));
+    ht->lookups = 0;
+    ht->probes = 0;
+    ht->grows = 0;
+    ht->growtime = 0;
+    ht->_table = (_hitem **)ytmalloc(ht->realsize * sizeof(_hitem *), YMEM_HTAB);
     if (!ht->_table) {
         yfree(ht);
         return NULL;
@@ -89,15 +107,21 @@ htdestroy(_htab *ht)
 
 
 int
-hadd(_htab *ht, int key, int val)
+hadd(_htab *ht, uintptr_t key, uintptr_t val)
 {
     unsigned int h;
+    uintptr_t a;
     _hitem *new, *p;
 
-    h = HHASH(ht, key);
+    // HHASH scrambles its argument, the item must keep the original key
+    // or it cannot be rehashed by _hgrow.
+    a = key;
+    h = HHASH(ht, a);
     p = ht->_table[h];
     new = NULL;
+    ht->lookups++;
     while(p) {
+        ht->probes++;
         if ((p->key == key) && (!p->free))
             return 0;
         if (p->free)
@@ -111,7 +135,7 @@ hadd(_htab *ht, int key, int val)
         new->free = 0;
         ht->freecount--;
     } else {
-        new = (_hitem *)ymalloc(sizeof(_hitem));
+        new = (_hitem *)ytmalloc(sizeof(_hitem), YMEM_HTAB);
         if (!new)
             return 0;
         new->key = key;
@@ -130,12 +154,16 @@ hadd(_htab *ht, int key, int val)
 }
 
 _hitem *
-hfind(_htab *ht, int key)
+hfind(_htab *ht, uintptr_t key)
 {
+    uintptr_t a;
     _hitem *p;
 
-    p = ht->_table[HHASH(ht, key)];
+    a = key;
+    p = ht->_table[HHASH(ht, a)];
+    ht->lookups++;
     while(p) {
+        ht->probes++;
         if ((p->key == key) && (!p->free)) {
             return p;
         }
@@ -6,6 +6,12 @@
 #ifndef YHASHTAB_H
 #define YHASHTAB_H
 
+#ifndef _MSC_VER
+#include "stdint.h"
+#else
+#include <stddef.h>
+#endif
+
 #define HSIZE(n) (1<<n)
 #define HMASK(n) (HSIZE(n)-1)
 #define SWAP(a, b) (((a) ^= (b)), ((b) ^= (a)), ((a) ^= (b)))
@@ -16,8 +22,8 @@
 #define HLOADFACTOR 0.75
 
 struct _hitem {
-    int key;
-    int val;
+    uintptr_t key; // wide enough to hold a pointer.
+    uintptr_t val;
     int free; // for recycling.
     struct _hitem *next;
 };
@@ -30,14 +36,20 @@ typedef struct {
     int mask;
     int freecount;
     _hitem ** _table;
+    // self instrumentation, kept across grows.
+    unsigned long lookups; // hfind() and hadd() calls
+    unsigned long probes; // items visited by them
+    unsigned long grows;
+    long long growtime; // in the ticks of the clock given to htsetclock()
 } _htab;
 
 _htab *htcreate(int logsize);
 void htdestroy(_htab *ht);
-_hitem *hfind(_htab *ht, int key);
-int hadd(_htab *ht, int key, int val);
+_hitem *hfind(_htab *ht, uintptr_t key);
+int hadd(_htab *ht, uintptr_t key, uintptr_t val);
 void henum(_htab *ht, int (*fn) (_hitem *item, void *arg), void *arg);
 int hcount(_htab *ht);
 void hfree(_htab *ht, _hitem *item);
+void htsetclock(long long (*fn)(void));
 
 #endif
@@ -0,0 +1,136 @@
+/*
+*    Log-linear latency histogram
+*/
+
+#include "_yhist.h"
+#include "_ymem.h"
+
+// floor(log2(v)) for v > 0.
+static int
+_hlog2(unsigned long long v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int r;
+
+    r = 0;
+    if (v >> 32) {
+        v >>= 32;
+        r += 32;
+    }
+    if (v >> 16) {
+        v >>= 16;
+        r += 16;
+    }
+    if (v >> 8) {
+        v >>= 8;
+        r += 8;
+    }
+    if (v >> 4) {
+        v >>= 4;
+        r += 4;
+    }
+    if (v >> 2) {
+        v >>= 2;
+        r += 2;
+    }
+    if (v >> 1)
+        r += 1;
+    return r;
+#endif
+}
+
+static int
+_hbucket(long long v)
+{
+    int e;
+
+    if (v < HIST_SUB_COUNT)
+        return (v < 0) ? 0 : (int)v;
+    e = _hlog2((unsigned long long)v);
+    if (e > HIST_MAX_EXP)
+        return HIST_BUCKETS-1;
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB_COUNT +
+           (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB_COUNT-1));
+}
+
+// returns the highest value that falls into the given bucket.
+static long long
+_hbucketmax(int b)
+{
+    int e, sub;
+
+    if (b < HIST_SUB_COUNT)
+        return b;
+    e = b / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    sub = b % HIST_SUB_COUNT;
+    return ((long long)(HIST_SUB_COUNT + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+_hist *
+histcreate(void)
+{
+    _hist *h;
+
+    h = (_hist *)ytmalloc(sizeof(_hist), YMEM_PIT);
+    if (!h)
+        return NULL;
+    histclear(h);
+    return h;
+}
+
+void
+histdestroy(_hist *h)
+{
+    yfree(h);
+}
+
+void
+histclear(_hist *h)
+{
+    int i;
+
+    h->count = 0;
+    h->max = 0;
+    for(i=0; i<HIST_BUCKETS; i++)
+        h->buckets[i] = 0;
+}
+
+void
+histadd(_hist *h, long long v)
+{
+    h->buckets[_hbucket(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+// returns the value below which p (0.0-1.0) of the recorded values fall.
+// The result is the upper bound of the matching bucket and never exceeds
+// the recorded maximum.
+long long
+histpercentile(_hist *h, double p)
+{
+    int i;
+    unsigned long rank, cum;
+    long long r;
+
+    if (!h->count)
+        return 0;
+    rank = (unsigned long)(p * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > h->count)
+        rank = h->count;
+
+    cum = 0;
+    for(i=0; i<HIST_BUCKETS; i++) {
+        cum += h->buckets[i];
+        if (cum >= rank) {
+            r = _hbucketmax(i);
+            return (r > h->max) ? h->max : r;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,30 @@
+#ifndef YHIST_H
+#define YHIST_H
+
+/*
+*    Log-linear latency histogram
+*
+*    Values are bucketed by their power of two first and then linearly
+*    into HIST_SUB_COUNT sub buckets inside that power, so the relative
+*    error of a reported value is bounded by 1/HIST_SUB_COUNT regardless
+*    of its magnitude.
+*/
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1<<HIST_SUB_BITS)
+#define HIST_MAX_EXP 40
+#define HIST_BUCKETS ((HIST_MAX_EXP-HIST_SUB_BITS+2) * HIST_SUB_COUNT)
+
+typedef struct {
+    unsigned long count;
+    long long max;
+    unsigned long buckets[HIST_BUCKETS];
+} _hist;
+
+_hist *histcreate(void);
+void histdestroy(_hist *h);
+void histadd(_hist *h, long long v);
+long long histpercentile(_hist *h, double p);
+void histclear(_hist *h);
+
+#endif
@@ -1,29 +1,104 @@
 #include "_ymem.h"
 #include "Python.h"
 
+typedef struct {
+    size_t size;
+    size_t tag;
+} _ymemhdr; // precedes every block, keeps the blocks 16 byte aligned.
+
 static unsigned long memused=0;
+static unsigned long mempeak=0;
+static unsigned long tagused[YMEM_TAGS];
+static unsigned long tagpeak[YMEM_TAGS];
+
+// the aggregator thread of the deferred mode allocates without the GIL.
+#ifdef _MSC_VER
+#include <windows.h>
+#define YMEMADD(v, n) InterlockedExchangeAdd((volatile LONG *)&(v), (LONG)(n))
+#define YMEMSUB(v, n) InterlockedExchangeAdd((volatile LONG *)&(v), -(LONG)(n))
+#else
+#define YMEMADD(v, n) __sync_fetch_and_add(&(v), (n))
+#define YMEMSUB(v, n) __sync_fetch_and_sub(&(v), (n))
+#endif
+
+// high-water marks are not updated atomically, a racing allocation may be
+// missed by a few bytes.
+#define YMEMPEAK(peak, used) if ((used) > (peak)) (peak) = (used)
 
 #ifdef DEBUG_MEM
 
-static dnode_t *dhead;
+#define DTABLE_INIT_SIZE 1024
+#define DHASH(p, size) ((unsigned int)(((uintptr_t)(p) >> 4) * 2654435761u) & ((size)-1))
+
+static const char *tagnames[YMEM_TAGS] = {"other", "pits", "contexts", "hashtables",
+                                         "callstacks", "stats"};
+static dnode_t **dtable; // live blocks by address
+static unsigned int dtsize;
 static unsigned int dsize;
+static volatile long dlock; // dtable is also changed by the aggregator thread.
+
+#ifdef _MSC_VER
+#define DLOCK() while (InterlockedExchange(&dlock, 1)) Sleep(0)
+#define DUNLOCK() InterlockedExchange(&dlock, 0)
+#else
+#define DLOCK() while (__sync_lock_test_and_set(&dlock, 1))
+#define DUNLOCK() __sync_lock_release(&dlock)
+#endif
+
+// doubles the live block table. The table is allocated with PyMem_Malloc as
+// it cannot account for itself.
+static int
+_dgrow(void)
+{
+    unsigned int i, newsize;
+    dnode_t **t, *v, *next;
+
+    newsize = dtsize ? dtsize * 2 : DTABLE_INIT_SIZE;
+    t = PyMem_Malloc(newsize * sizeof(dnode_t *));
+    if (!t)
+        return 0;
+    for(i=0; i<newsize; i++)
+        t[i] = NULL;
+    for(i=0; i<dtsize; i++) {
+        for(v=dtable[i]; v; v=next) {
+            next = v->next;
+            v->next = t[DHASH(v->ptr, newsize)];
+            t[DHASH(v->ptr, newsize)] = v;
+        }
+    }
+    if (dtable)
+        PyMem_Free(dtable);
+    dtable = t;
+    dtsize = newsize;
+    return 1;
+}
 
 void YMEMLEAKCHECK(void)
 {
+    unsigned int i, tleak;
+    unsigned int tagleak[YMEM_TAGS];
     dnode_t *v;
-    unsigned int tleak;
 
-    v = dhead;
     tleak = 0;
-    while(v) {
-        fprintf(stderr, "[YMEM]    Leaked block: (addr:%p) (size:%d)\n", v->ptr, v->size);
-        tleak += v->size;
-        v = v->next;
+    for(i=0; i<YMEM_TAGS; i++)
+        tagleak[i] = 0;
+    for(i=0; i<dtsize; i++) {
+        for(v=dtable[i]; v; v=v->next) {
+            fprintf(stderr, "[YMEM]    Leaked block: (addr:%p) (size:%d) (%s)\n", v->ptr,
+                    v->size, tagnames[v->tag]);
+            tleak += v->size;
+            tagleak[v->tag] += v->size;
+        }
     }
-    if (tleak == 0)
+    if (tleak == 0) {
         fprintf(stderr, "[YMEM]    Application currently has no leakage.[%d]\n", dsize);
-    else
-        fprintf(stderr, "[YMEM]    Application currently leaking %d bytes.[%d]\n", tleak, dsize);
+        return;
+    }
+    fprintf(stderr, "[YMEM]    Application currently leaking %d bytes.[%d]\n", tleak, dsize);
+    for(i=0; i<YMEM_TAGS; i++) {
+        if (tagleak[i])
+            fprintf(stderr, "[YMEM]        %s: %d bytes\n", tagnames[i], tagleak[i]);
+    }
 }
 #else
 void YMEMLEAKCHECK(void)
@@ -39,63 +114,107 @@ ymemusage(void)
     return memused;
 }
 
+unsigned long
+ymempeak(void)
+{
+    return mempeak;
+}
+
+unsigned long
+ymemtagusage(int tag)
+{
+    return tagused[tag];
+}
+
+unsigned long
+ymemtagpeak(int tag)
+{
+    return tagpeak[tag];
+}
+
+// starts the high-water marks over from the current usage.
+void
+ymemresetpeak(void)
+{
+    int i;
+
+    mempeak = memused;
+    for(i=0; i<YMEM_TAGS; i++)
+        tagpeak[i] = tagused[i];
+}
+
 void *
-ymalloc(size_t size)
+ytmalloc(size_t size, int tag)
 {
-    void *p;
+    _ymemhdr *p;
 #ifdef DEBUG_MEM
     dnode_t *v;
+    unsigned int h;
 #endif
 
-    p = PyMem_Malloc(size+sizeof(size_t));
+    p = PyMem_Malloc(size+sizeof(_ymemhdr));
     if (!p) {
         yerr("malloc(%d) failed. No memory?", size);
         return NULL;
     }
-    memused += size;
-    *(size_t *)p = size;
+    YMEMADD(memused, size);
+    YMEMPEAK(mempeak, memused);
+    YMEMADD(tagused[tag], size);
+    YMEMPEAK(tagpeak[tag], tagused[tag]);
+    p->size = size;
+    p->tag = tag;
 #ifdef DEBUG_MEM
-    if (dhead)
-        yinfo("_ymalloc(%d) called[%p].[old_head:%p]", size, p, dhead->ptr);
-    else
-        yinfo("_ymalloc(%d) called[%p].[old_head:nil]", size, p);
+    yinfo("_ymalloc(%d) called[%p].[%s]", size, p, tagnames[tag]);
     v = PyMem_Malloc(sizeof(dnode_t));
+    if (!v) {
+        yerr("leak tracker node cannot be allocated, the block is not tracked.[%p]", p);
+        return p+1;
+    }
     v->ptr = p;
     v->size = size;
-    v->next = dhead;
-    dhead = v;
+    v->tag = tag;
+    DLOCK();
+    if (dsize >= dtsize && !_dgrow()) {
+        DUNLOCK();
+        PyMem_Free(v);
+        yerr("leak tracker cannot grow, the block is not tracked.[%p]", p);
+        return p+1;
+    }
+    h = DHASH(p, dtsize);
+    v->next = dtable[h];
+    dtable[h] = v;
     dsize++;
+    DUNLOCK();
 #endif
-    return (char *)p+sizeof(size_t);
+    return p+1;
 }
 
 void
 yfree(void *p)
 {
+    _ymemhdr *hdr;
 #ifdef DEBUG_MEM
     dnode_t *v;
-    dnode_t *prev;
+    dnode_t **prev;
 #endif
-    p = (char *)p - sizeof(size_t);
-    memused -= *(size_t *)p;
+    hdr = (_ymemhdr *)p - 1;
+    YMEMSUB(memused, hdr->size);
+    YMEMSUB(tagused[hdr->tag], hdr->size);
 #ifdef DEBUG_MEM
-    v = dhead;
-    prev = NULL;
-    while(v) {
-        if (v->ptr == p) {
-            if (prev)
-                prev->next = v->next;
-            else
-                dhead = v->next;
-
-            yinfo("_yfree(%p) called.", p);
-            PyMem_Free(v);
+    DLOCK();
+    prev = dtsize ? &dtable[DHASH(hdr, dtsize)] : NULL;
+    for(v = prev ? *prev : NULL; v; prev=&v->next, v=v->next) {
+        if (v->ptr == hdr) {
+            *prev = v->next;
             dsize--;
             break;
         }
-        prev = v;
-        v = v->next;
+    }
+    DUNLOCK();
+    if (v) {
+        yinfo("_yfree(%p) called.", hdr);
+        PyMem_Free(v);
     }
 #endif
-    PyMem_Free(p);
+    PyMem_Free(hdr);
 }
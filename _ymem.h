@@ -4,17 +4,32 @@
 #include "stdlib.h"
 #include "_ydebug.h"
 
+// subsystems the memory of the profiler is accounted to.
+#define YMEM_OTHER 0
+#define YMEM_PIT 1 // pits and their histograms
+#define YMEM_CTX 2
+#define YMEM_HTAB 3
+#define YMEM_CSTACK 4
+#define YMEM_STATS 5 // stats being read, saved or loaded
+#define YMEM_TAGS 6
+
 struct dnode {
     void *ptr;
     unsigned int size;
+    int tag;
     struct dnode *next;
 };
 typedef struct dnode dnode_t;
 
-void *ymalloc(size_t size);
+#define ymalloc(size) ytmalloc((size), YMEM_OTHER)
+
+void *ytmalloc(size_t size, int tag);
 void yfree(void *p);
 unsigned long ymemusage(void);
+unsigned long ymempeak(void);
+unsigned long ymemtagusage(int tag);
+unsigned long ymemtagpeak(int tag);
+void ymemresetpeak(void);
 void YMEMLEAKCHECK(void);
 
 #endif
-
@@ -0,0 +1,113 @@
+#include "Python.h"
+#include "_ymmap.h"
+#include "_ymem.h"
+
+#ifdef MS_WINDOWS
+
+#include <windows.h>
+
+_mmap *
+mmcreate(const char *path, size_t size)
+{
+    _mmap *m;
+    HANDLE f, mp;
+    void *base;
+
+    f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) {
+        yerr("mmap file cannot be created.(%s)", path);
+        return NULL;
+    }
+    mp = CreateFileMappingA(f, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32),
+                            (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (!mp) {
+        CloseHandle(f);
+        yerr("mmap file cannot be mapped.(%s)", path);
+        return NULL;
+    }
+    base = MapViewOfFile(mp, FILE_MAP_WRITE, 0, 0, size);
+    if (!base) {
+        CloseHandle(mp);
+        CloseHandle(f);
+        yerr("mmap file cannot be mapped.(%s)", path);
+        return NULL;
+    }
+    m = (_mmap *)ymalloc(sizeof(_mmap));
+    if (!m) {
+        UnmapViewOfFile(base);
+        CloseHandle(mp);
+        CloseHandle(f);
+        return NULL;
+    }
+    m->base = base;
+    m->size = size;
+    m->_file = f;
+    m->_map = mp;
+    return m;
+}
+
+void
+mmdestroy(_mmap *m)
+{
+    FlushViewOfFile(m->base, 0);
+    UnmapViewOfFile(m->base);
+    CloseHandle((HANDLE)m->_map);
+    CloseHandle((HANDLE)m->_file);
+    yfree(m);
+}
+
+#else /* !MS_WINDOWS */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+_mmap *
+mmcreate(const char *path, size_t size)
+{
+    _mmap *m;
+    int fd;
+    void *base;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        yerr("mmap file cannot be created.(%s)", path);
+        return NULL;
+    }
+    // the file is sparse, untouched pages do not take disk space.
+    if (ftruncate(fd, (off_t)size) < 0) {
+        close(fd);
+        yerr("mmap file cannot be resized.(%s)", path);
+        return NULL;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        yerr("mmap file cannot be mapped.(%s)", path);
+        return NULL;
+    }
+    m = (_mmap *)ymalloc(sizeof(_mmap));
+    if (!m) {
+        munmap(base, size);
+        close(fd);
+        return NULL;
+    }
+    m->base = base;
+    m->size = size;
+    m->_file = (void *)(intptr_t)fd;
+    m->_map = NULL;
+    return m;
+}
+
+void
+mmdestroy(_mmap *m)
+{
+    munmap(m->base, m->size);
+    close((int)(intptr_t)m->_file);
+    yfree(m);
+}
+
+#endif /* else MS_WINDOWS*/
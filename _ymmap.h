@@ -0,0 +1,22 @@
+#ifndef YMMAP_H
+#define YMMAP_H
+
+#include <stddef.h>
+
+/*
+*    Portable memory mapped file. The file is created (or truncated) with
+*    the given size and mapped shared, so every store is visible to other
+*    processes mapping the same file and survives a crash of this one.
+*/
+
+typedef struct {
+    void *base;
+    size_t size;
+    void *_file; // fd on POSIX, file and mapping handles on Windows.
+    void *_map;
+} _mmap;
+
+_mmap *mmcreate(const char *path, size_t size);
+void mmdestroy(_mmap *m);
+
+#endif
@@ -0,0 +1,69 @@
+#include "_yqueue.h"
+#include "_ymem.h"
+#include "_ystatic.h"
+
+// size is rounded up to a power of two so that the slot index is a mask.
+_queue *
+qcreate(int size, int itemsize)
+{
+    _queue *q;
+    unsigned long n;
+
+    for(n=1; n<(unsigned long)size; n<<=1)
+        ;
+
+    q = (_queue *)ymalloc(sizeof(_queue));
+    if (!q)
+        return NULL;
+    q->_items = ymalloc(n * itemsize);
+    if (!q->_items) {
+        yfree(q);
+        return NULL;
+    }
+    q->head = 0;
+    q->tail = 0;
+    q->mask = n-1;
+    q->itemsize = itemsize;
+    return q;
+}
+
+void
+qdestroy(_queue *q)
+{
+    yfree(q->_items);
+    yfree(q);
+}
+
+// returns the slot of the next record or NULL if the queue is full.
+void *
+qslot(_queue *q)
+{
+    if (q->head - q->tail > q->mask)
+        return NULL;
+    return q->_items + (q->head & q->mask) * q->itemsize;
+}
+
+// publishes the record filled in the slot returned by qslot().
+void
+qpush(_queue *q)
+{
+    YBARRIER(); // the record must be visible before the new head.
+    q->head++;
+}
+
+// returns the oldest record or NULL if the queue is empty.
+void *
+qpeek(_queue *q)
+{
+    if (q->tail == q->head)
+        return NULL;
+    YBARRIER(); // do not read the record before head.
+    return q->_items + (q->tail & q->mask) * q->itemsize;
+}
+
+void
+qpop(_queue *q)
+{
+    YBARRIER(); // done reading the record before the producer reuses it.
+    q->tail++;
+}
@@ -0,0 +1,28 @@
+#ifndef YQUEUE_H
+#define YQUEUE_H
+
+/*
+*    Lock-free single producer/single consumer queue of fixed size records.
+*    The producer fills the slot returned by qslot() and publishes it with
+*    qpush(). The consumer reads the record returned by qpeek() and
+*    releases it with qpop(). Several consumers have to be serialized by
+*    the caller.
+*/
+
+typedef struct {
+    volatile unsigned long head; // next slot to write, owned by the producer.
+    char _pad[64]; // keep head and tail on different cache lines.
+    volatile unsigned long tail; // next slot to read, owned by the consumer.
+    unsigned long mask;
+    int itemsize;
+    char *_items;
+} _queue;
+
+_queue *qcreate(int size, int itemsize);
+void qdestroy(_queue *q);
+void *qslot(_queue *q);
+void qpush(_queue *q);
+void *qpeek(_queue *q);
+void qpop(_queue *q);
+
+#endif
@@ -0,0 +1,61 @@
+#include "_yring.h"
+#include "_ymem.h"
+
+_ring *
+rcreate(int size, int itemsize)
+{
+    _ring *r;
+
+    r = (_ring *)ymalloc(sizeof(_ring));
+    if (!r)
+        return NULL;
+    r->_items = ymalloc(size * itemsize);
+    if (!r->_items) {
+        yfree(r);
+        return NULL;
+    }
+    r->size = size;
+    r->itemsize = itemsize;
+    r->head = 0;
+    return r;
+}
+
+void
+rdestroy(_ring *r)
+{
+    yfree(r->_items);
+    yfree(r);
+}
+
+// returns the slot for the next record. The caller fills it.
+void *
+rpush(_ring *r)
+{
+    return r->_items + (r->head++ % r->size) * r->itemsize;
+}
+
+// returns the i'th oldest record that is still in the ring.
+void *
+rget(_ring *r, int i)
+{
+    unsigned long first;
+
+    if (i < 0 || i >= rcount(r))
+        return NULL;
+    first = (r->head > (unsigned long)r->size) ? r->head - r->size : 0;
+    return r->_items + ((first + i) % r->size) * r->itemsize;
+}
+
+int
+rcount(_ring *r)
+{
+    if (r->head > (unsigned long)r->size)
+        return r->size;
+    return (int)r->head;
+}
+
+void
+rclear(_ring *r)
+{
+    r->head = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef YRING_H
+#define YRING_H
+
+/*
+*    Bounded ring of fixed size records. When the ring is full the oldest
+*    record is overwritten.
+*/
+
+typedef struct {
+    int size;
+    int itemsize;
+    unsigned long head; // total number of records pushed so far.
+    char *_items;
+} _ring;
+
+_ring *rcreate(int size, int itemsize);
+void rdestroy(_ring *r);
+void *rpush(_ring *r);
+void *rget(_ring *r, int i);
+int rcount(_ring *r);
+void rclear(_ring *r);
+
+#endif
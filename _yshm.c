@@ -0,0 +1,117 @@
+/*
+*    Live stats published in a shared memory mapped file
+*/
+
+#include "_yshm.h"
+#include "_ymem.h"
+#include "_ystatic.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+_shm *
+shmcreate(const char *path, unsigned int pitcap, unsigned int ctxcap)
+{
+    _shm *s;
+    _mmap *m;
+
+    m = mmcreate(path, sizeof(_shmhdr) + pitcap * sizeof(_shmpit) +
+                 ctxcap * sizeof(_shmctx));
+    if (!m)
+        return NULL;
+    s = (_shm *)ymalloc(sizeof(_shm));
+    if (!s) {
+        mmdestroy(m);
+        return NULL;
+    }
+    memset(m->base, 0, m->size);
+    s->_map = m;
+    s->hdr = (_shmhdr *)m->base;
+    s->pits = (_shmpit *)(s->hdr + 1);
+    s->ctxs = (_shmctx *)(s->pits + pitcap);
+
+    s->hdr->version = SHM_VERSION;
+    s->hdr->pitcap = pitcap;
+    s->hdr->ctxcap = ctxcap;
+    s->hdr->pid = getpid();
+    YBARRIER();
+    memcpy(s->hdr->magic, SHM_MAGIC, 8); // a reader may trust the header from now on.
+    return s;
+}
+
+void
+shmdestroy(_shm *s)
+{
+    mmdestroy(s->_map);
+    yfree(s);
+}
+
+// returns the record of a new pit or NULL if the file is full.
+_shmpit *
+shmaddpit(_shm *s, const char *name, int builtin)
+{
+    _shmpit *p;
+
+    if (s->hdr->npits >= s->hdr->pitcap) {
+        s->hdr->dropped++;
+        return NULL;
+    }
+    p = &s->pits[s->hdr->npits];
+    strncpy(p->name, name, SHM_NAME_LEN-1);
+    p->builtin = builtin;
+    YBARRIER();
+    s->hdr->npits++;
+    return p;
+}
+
+_shmctx *
+shmaddctx(_shm *s, long long tid)
+{
+    _shmctx *c;
+
+    if (s->hdr->nctxs >= s->hdr->ctxcap) {
+        s->hdr->dropped++;
+        return NULL;
+    }
+    c = &s->ctxs[s->hdr->nctxs];
+    c->tid = tid;
+    YBARRIER();
+    s->hdr->nctxs++;
+    return c;
+}
+
+// the class name of a thread is known only after its first event, so it is
+// set once afterwards.
+void
+shmsetctxname(_shmctx *c, const char *name)
+{
+    strncpy(c->name, name, SHM_CTX_NAME_LEN-1);
+}
+
+void
+shmupdpit(_shmpit *p, unsigned long long callcount, long long ttotal, long long tsubtotal)
+{
+    p->seq++;
+    YBARRIER();
+    p->callcount = callcount;
+    p->ttotal = ttotal;
+    p->tsubtotal = tsubtotal;
+    YBARRIER();
+    p->seq++;
+}
+
+void
+shmupdctx(_shmctx *c, unsigned long long sched_cnt, long long ttotal)
+{
+    c->seq++;
+    YBARRIER();
+    c->sched_cnt = sched_cnt;
+    c->ttotal = ttotal;
+    YBARRIER();
+    c->seq++;
+}
@@ -0,0 +1,90 @@
+#ifndef YSHM_H
+#define YSHM_H
+
+#include "_ymmap.h"
+
+/*
+*    Live stats published in a shared memory mapped file
+*
+*    The file is a header followed by SHM_PIT_COUNT pit records and
+*    SHM_CTX_COUNT context records. The layout uses fixed size fields in
+*    the native byte order of the host, so any process on the same host can
+*    read it without the profiled process taking part, and the last
+*    published values stay in the file if the process dies.
+*
+*    Records are appended: the name of a record is written before npits
+*    (nctxs) is increased and never changes afterwards. The counters are
+*    guarded by a sequence number which is odd while a record is being
+*    updated; readers copy a record and retry if the sequence is odd or has
+*    changed during the copy. Times are in ticks, multiply them with
+*    tickfactor for seconds. Pit times are measured every timing_sample
+*    calls only, so they are multiplied with timing_sample as well.
+*
+*    layout (version 1):
+*        header (64 bytes)
+*            char magic[8]            "YAPPISHM"
+*            u32 version, pitcap, ctxcap, npits, nctxs, dropped
+*            i64 pid, tstart
+*            f64 tickfactor
+*            i32 running, u32 timing_sample
+*        pitcap * (u32 seq, u32 builtin, u64 callcount, i64 ttotal,
+*                  i64 tsubtotal, char name[SHM_NAME_LEN])
+*        ctxcap * (u32 seq, u32 reserved, i64 tid, u64 sched_cnt,
+*                  i64 ttotal, char name[SHM_CTX_NAME_LEN])
+*/
+
+#define SHM_MAGIC "YAPPISHM"
+#define SHM_VERSION 1
+#define SHM_NAME_LEN 240
+#define SHM_CTX_NAME_LEN 32
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int pitcap;
+    unsigned int ctxcap;
+    volatile unsigned int npits;
+    volatile unsigned int nctxs;
+    unsigned int dropped; // records that did not fit into the file.
+    long long pid;
+    long long tstart;
+    double tickfactor;
+    volatile int running;
+    unsigned int timing_sample;
+} _shmhdr;
+
+typedef struct {
+    volatile unsigned int seq;
+    unsigned int builtin;
+    unsigned long long callcount;
+    long long ttotal;
+    long long tsubtotal;
+    char name[SHM_NAME_LEN];
+} _shmpit;
+
+typedef struct {
+    volatile unsigned int seq;
+    unsigned int _reserved;
+    long long tid;
+    unsigned long long sched_cnt;
+    long long ttotal;
+    char name[SHM_CTX_NAME_LEN];
+} _shmctx;
+
+typedef struct {
+    _shmhdr *hdr;
+    _shmpit *pits;
+    _shmctx *ctxs;
+    _mmap *_map;
+} _shm;
+
+_shm *shmcreate(const char *path, unsigned int pitcap, unsigned int ctxcap);
+void shmdestroy(_shm *s);
+_shmpit *shmaddpit(_shm *s, const char *name, int builtin);
+_shmctx *shmaddctx(_shm *s, long long tid);
+void shmsetctxname(_shmctx *c, const char *name);
+void shmupdpit(_shmpit *p, unsigned long long callcount, long long ttotal,
+               long long tsubtotal);
+void shmupdctx(_shmctx *c, unsigned long long sched_cnt, long long ttotal);
+
+#endif
@@ -5,12 +5,44 @@
 #include "stdint.h"
 #endif
 
+#define YCACHELINE 64
+
+// full memory barrier for the structures shared with other threads or
+// processes without a lock.
+#ifdef _MSC_VER
+#include <windows.h>
+#define YBARRIER() MemoryBarrier()
+#else
+#define YBARRIER() __sync_synchronize()
+#endif
+
 // static pool sizes
 #define FL_PIT_SIZE 1000
 #define FL_CTX_SIZE 100
+#define FL_GEN_SIZE 100
 #define HT_PIT_SIZE 10
 #define HT_CTX_SIZE 5
+#define HT_CODE_SIZE 10
+#define HT_GEN_SIZE 7
+#define HT_TAG_SIZE 5
 #define HT_CS_COUNT_SIZE 7
+#define HT_DUMP_SIZE 10
+#define CS_POOL_SIZE 100
+#define PIT_CACHE_SIZE 32 // power of two
+#define EVENT_TYPES 8 // PyTrace_* event types counted by the hook
+#define SELF_TIMING_SAMPLE 64 // the hook times itself on one in this many events
+#define SLOW_RING_SIZE 64
+#define SLOW_STACK_DEPTH 32
+#define LINE_STACK_DEPTH 16 // nested line profiled frames tracked per thread
+#define TRACE_RING_SIZE (1<<18)
+#define CTXID_CAPSULE_NAME "yappi.context_id" // capsule of a native context id callback
+#define COLD_CALLS 10 // first calls of a function timed apart by default
+#define DEFER_QUEUE_SIZE (1<<13)
+#define AGG_INTERVAL 1 // msecs the aggregator thread sleeps between drains
+#define SHM_PIT_COUNT 4096
+#define SHM_CTX_COUNT 256
+#define AGENT_POLL_INTERVAL 100 // msecs the agent thread sleeps between checks
+#define AGENT_PATH_LEN 4096
 
 // stat related
 #define M_LEFT 1
@@ -22,6 +22,12 @@ tickfactor(void)
         return 0.000001;  /* unlikely */
 }
 
+void
+ysleep(int ms)
+{
+    Sleep(ms);
+}
+
 #else /* !MS_WINDOWS */
 
 #ifndef HAVE_GETTIMEOFDAY
@@ -34,6 +40,7 @@ tickfactor(void)
 #include <sys/resource.h>
 #include <sys/times.h>
 #endif
+#include <time.h>
 
 long long
 tickcount(void)
@@ -56,4 +63,14 @@ tickfactor(void)
     return 0.000001;
 }
 
+void
+ysleep(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
 #endif /* else MS_WINDOWS*/
@@ -15,6 +15,9 @@ tickcount(void);
 double
 tickfactor(void);
 
+void
+ysleep(int ms);
+
 #endif
 
 
@@ -0,0 +1,56 @@
+#include "_ytiming.h"
+#include "_ytrace.h"
+#include "_ymem.h"
+
+// capacity is rounded up to a power of two so that the ring index is a mask.
+_trace *
+trcreate(const char *path, long tid, unsigned long long capacity)
+{
+    _trace *tr;
+    unsigned long long size;
+
+    for(size=1; size<capacity; size<<=1)
+        ;
+    capacity = size;
+
+    tr = (_trace *)ymalloc(sizeof(_trace));
+    if (!tr)
+        return NULL;
+    tr->m = mmcreate(path, sizeof(_tracehdr) + capacity * sizeof(_tracerec));
+    if (!tr->m) {
+        yfree(tr);
+        return NULL;
+    }
+    tr->hdr = (_tracehdr *)tr->m->base;
+    tr->recs = (_tracerec *)((char *)tr->m->base + sizeof(_tracehdr));
+
+    memcpy(tr->hdr->magic, TRACE_MAGIC, sizeof(tr->hdr->magic));
+    tr->hdr->version = TRACE_VERSION;
+    tr->hdr->recsize = sizeof(_tracerec);
+    tr->hdr->capacity = capacity;
+    tr->hdr->head = 0;
+    tr->hdr->tid = tid;
+    tr->hdr->tickfactor = tickfactor();
+    return tr;
+}
+
+void
+trdestroy(_trace *tr)
+{
+    mmdestroy(tr->m);
+    yfree(tr);
+}
+
+// the record is filled before head is advanced, so a reader of a crashed
+// process never sees a half written record below head.
+void
+tradd(_trace *tr, long long t, unsigned int pit, unsigned int event)
+{
+    _tracerec *r;
+
+    r = &tr->recs[tr->hdr->head & (tr->hdr->capacity-1)];
+    r->t = t;
+    r->pit = pit;
+    r->event = event;
+    tr->hdr->head++;
+}
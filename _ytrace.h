@@ -0,0 +1,44 @@
+#ifndef YTRACE_H
+#define YTRACE_H
+
+#include "_ymmap.h"
+
+/*
+*    Per-thread event trace. Every call/return event is appended as a fixed
+*    size record into a memory mapped ring file; once the ring is full the
+*    oldest records are overwritten. The layout is read back by
+*    yappi.convert_trace(), keep them in sync.
+*/
+
+#define TRACE_MAGIC "YAPPITRC"
+#define TRACE_VERSION 1
+#define TRACE_CALL 0
+#define TRACE_RETURN 1
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int recsize;
+    unsigned long long capacity; // in records
+    unsigned long long head; // total number of records written so far.
+    long long tid;
+    double tickfactor;
+} _tracehdr;
+
+typedef struct {
+    long long t;
+    unsigned int pit;
+    unsigned int event;
+} _tracerec;
+
+typedef struct {
+    _mmap *m;
+    _tracehdr *hdr;
+    _tracerec *recs;
+} _trace;
+
+_trace *trcreate(const char *path, long tid, unsigned long long capacity);
+void trdestroy(_trace *tr);
+void tradd(_trace *tr, long long t, unsigned int pit, unsigned int event);
+
+#endif
@@ -9,7 +9,9 @@ setup(name="_yappi",
 					 ("_yappi",
 					  sources = ["_yappi.c", "_ycallstack.c", 
 					  "_yhashtab.c", "_ymem.c", "_yfreelist.c", 
-					  "_ytiming.c"],
+					  "_ytiming.c", "_yhist.c", "_yring.c",
+					  "_ymmap.c", "_ytrace.c", "_yqueue.c", "_ydump.c",
+					  "_yshm.c"],
 					  #define_macros=[('DEBUG_MEM', '1'), ('DEBUG_CALL', '1'), ('YDEBUG', '1')],
 					  #define_macros=[('YDEBUG', '1')],
 					  #define_macros=[('DEBUG_CALL', '1')],
@@ -0,0 +1,413 @@
+/*
+*    Microbenchmarks of the core data structures
+*
+*    Measures the hash table, callstack and freelist operations the
+*    profiler hook runs on every event, without Python. Build and run from
+*    this directory with:
+*        cc -O2 -I.. -o benchcore benchcore.c ymemstub.c ../_yhashtab.c \
+*            ../_ycallstack.c ../_yfreelist.c ../_yhist.c
+*        ./benchcore [n]
+*
+*    Every benchmark runs twice: once timed as a whole for ops_per_sec and
+*    once timed per operation for the latency percentiles, which include
+*    timer_overhead_ns. Each table resize seen while adding keys is listed
+*    under hgrow with its pause. The results are written to stdout as JSON.
+*/
+
+#include "_yhashtab.h"
+#include "_ycallstack.h"
+#include "_yfreelist.h"
+#include "_yhist.h"
+#include "_ymem.h"
+#include "_ystatic.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define BENCH_DEFAULT_N 100000
+#define BENCH_STACK_DEPTH 64
+#define BENCH_FL_BATCH 500
+#define BENCH_MAX_GROWS 64
+#define ARENA_STRIDE 48 // pymalloc hands out code objects this far apart
+
+typedef struct {
+    const char *keys;
+    int logsize;
+    int items;
+    long long pause;
+} _grow;
+
+static _grow grows[BENCH_MAX_GROWS];
+static int ngrows = 0;
+static int nresults = 0;
+static unsigned int seed = 1;
+
+static long long
+_now(void)
+{
+#ifdef _MSC_VER
+    LARGE_INTEGER c, f;
+
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&f);
+    return (long long)(c.QuadPart * (1000000000.0 / f.QuadPart));
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static unsigned int
+_rand(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xFFFFFF;
+}
+
+static void
+_shuffle(uintptr_t *a, int n)
+{
+    int i, j;
+    uintptr_t t;
+
+    for(i=n-1; i>0; i--) {
+        j = _rand() % (i+1);
+        t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+static void
+_report(const char *name, const char *keys, long long ops, long long elapsed,
+        _hist *lat)
+{
+    printf("%s\n    {\"name\": \"%s%s%s\", \"ops\": %lld, \"ops_per_sec\": %.0f, "
+           "\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, \"max_ns\": %lld}",
+           nresults ? "," : "", name, keys ? "/" : "", keys ? keys : "", ops,
+           elapsed > 0 ? ops * 1e9 / elapsed : 0.0,
+           histpercentile(lat, 0.5), histpercentile(lat, 0.99),
+           histpercentile(lat, 0.999), lat->max);
+    nresults++;
+}
+
+// the latency of an empty timed region.
+static long long
+_timer_overhead(void)
+{
+    int i;
+    long long t0, r;
+    _hist *h;
+
+    h = histcreate();
+    for(i=0; i<BENCH_DEFAULT_N; i++) {
+        t0 = _now();
+        histadd(h, _now() - t0);
+    }
+    r = histpercentile(h, 0.5);
+    histdestroy(h);
+    return r;
+}
+
+// The benchmarks below time every operation if lat is given and only the
+// whole run otherwise. They return the number of operations done.
+
+static long long
+_bench_hadd(uintptr_t *keys, int n, const char *kname, _htab **out, _hist *lat)
+{
+    int i, logsize;
+    long long t0, t;
+    _htab *ht;
+
+    ht = htcreate(HT_PIT_SIZE);
+    for(i=0; i<n; i++) {
+        if (!lat) {
+            hadd(ht, keys[i], i);
+            continue;
+        }
+        logsize = ht->logsize;
+        t0 = _now();
+        hadd(ht, keys[i], i);
+        t = _now() - t0;
+        histadd(lat, t);
+        if (ht->logsize != logsize && ngrows < BENCH_MAX_GROWS) {
+            grows[ngrows].keys = kname;
+            grows[ngrows].logsize = ht->logsize;
+            grows[ngrows].items = hcount(ht);
+            grows[ngrows].pause = t;
+            ngrows++;
+        }
+    }
+    *out = ht;
+    return n;
+}
+
+static long long
+_bench_hfind(_htab *ht, uintptr_t *keys, int n, _hist *lat)
+{
+    int i;
+    long long t0;
+
+    for(i=0; i<n; i++) {
+        if (!lat) {
+            hfind(ht, keys[i]);
+            continue;
+        }
+        t0 = _now();
+        hfind(ht, keys[i]);
+        histadd(lat, _now() - t0);
+    }
+    return n;
+}
+
+// the profiler frees items it has just looked up, so time both.
+static long long
+_bench_hfree(_htab *ht, uintptr_t *keys, int n, _hist *lat)
+{
+    int i;
+    long long t0;
+    _hitem *it;
+
+    for(i=0; i<n; i++) {
+        if (!lat) {
+            it = hfind(ht, keys[i]);
+            if (it)
+                hfree(ht, it);
+            continue;
+        }
+        t0 = _now();
+        it = hfind(ht, keys[i]);
+        if (it)
+            hfree(ht, it);
+        histadd(lat, _now() - t0);
+    }
+    return n;
+}
+
+// adds the keys back into the slots freed by _bench_hfree.
+static long long
+_bench_hrecycle(_htab *ht, uintptr_t *keys, int n, _hist *lat)
+{
+    int i;
+    long long t0;
+
+    for(i=0; i<n; i++) {
+        if (!lat) {
+            hadd(ht, keys[i], i);
+            continue;
+        }
+        t0 = _now();
+        hadd(ht, keys[i], i);
+        histadd(lat, _now() - t0);
+    }
+    return n;
+}
+
+static void
+_run_htab(uintptr_t *keys, int n, const char *kname)
+{
+    int pass;
+    long long ops, t0, el[4];
+    _hist *lat[4];
+    _htab *ht;
+
+    for(pass=0; pass<2; pass++) {
+        lat[0] = lat[1] = lat[2] = lat[3] = NULL;
+        if (pass) {
+            lat[0] = histcreate();
+            lat[1] = histcreate();
+            lat[2] = histcreate();
+            lat[3] = histcreate();
+        }
+
+        t0 = _now();
+        ops = _bench_hadd(keys, n, kname, &ht, lat[0]);
+        el[0] = _now() - t0;
+        _shuffle(keys, n);
+        t0 = _now();
+        _bench_hfind(ht, keys, n, lat[1]);
+        el[1] = _now() - t0;
+        t0 = _now();
+        _bench_hfree(ht, keys, n, lat[2]);
+        el[2] = _now() - t0;
+        t0 = _now();
+        _bench_hrecycle(ht, keys, n, lat[3]);
+        el[3] = _now() - t0;
+        htdestroy(ht);
+
+        if (!pass)
+            continue;
+        _report("hadd", kname, ops, el[0], lat[0]);
+        _report("hfind", kname, ops, el[1], lat[1]);
+        _report("hfree", kname, ops, el[2], lat[2]);
+        _report("hadd_recycle", kname, ops, el[3], lat[3]);
+        histdestroy(lat[0]);
+        histdestroy(lat[1]);
+        histdestroy(lat[2]);
+        histdestroy(lat[3]);
+    }
+}
+
+// pushes and pops BENCH_STACK_DEPTH frames at a time. With recursive set
+// all frames are of the same function, which is the case scount is for.
+static long long
+_bench_stack(int n, int recursive, _hist *lat)
+{
+    int i, d;
+    long long t0, ops;
+    _cstack *cs;
+    void *ckey;
+
+    cs = screate(16); // grows to the depth on the first round
+    ops = 0;
+    for(i=0; i<n; i+=2*BENCH_STACK_DEPTH) {
+        for(d=0; d<BENCH_STACK_DEPTH; d++) {
+            ckey = (void *)(uintptr_t)(recursive ? 0x1000 : 0x1000 + d * ARENA_STRIDE);
+            if (!lat) {
+                spush(cs, ckey);
+                continue;
+            }
+            t0 = _now();
+            spush(cs, ckey);
+            histadd(lat, _now() - t0);
+        }
+        for(d=0; d<BENCH_STACK_DEPTH; d++) {
+            if (!lat) {
+                spop(cs);
+                continue;
+            }
+            t0 = _now();
+            spop(cs);
+            histadd(lat, _now() - t0);
+        }
+        ops += 2*BENCH_STACK_DEPTH;
+    }
+    sdestroy(cs);
+    return ops;
+}
+
+static long long
+_bench_freelist(int n, _hist *lat)
+{
+    int i, j;
+    long long t0, ops;
+    void *items[BENCH_FL_BATCH];
+    _freelist *fl;
+
+    fl = flcreate(128, FL_PIT_SIZE, YMEM_PIT);
+    ops = 0;
+    for(i=0; i<n; i+=2*BENCH_FL_BATCH) {
+        for(j=0; j<BENCH_FL_BATCH; j++) {
+            if (!lat) {
+                items[j] = flget(fl);
+                continue;
+            }
+            t0 = _now();
+            items[j] = flget(fl);
+            histadd(lat, _now() - t0);
+        }
+        for(j=BENCH_FL_BATCH-1; j>=0; j--) {
+            if (!lat) {
+                flput(fl, items[j]);
+                continue;
+            }
+            t0 = _now();
+            flput(fl, items[j]);
+            histadd(lat, _now() - t0);
+        }
+        ops += 2*BENCH_FL_BATCH;
+    }
+    fldestroy(fl);
+    return ops;
+}
+
+static void
+_run_stack(int n, int recursive)
+{
+    long long ops, t0, el;
+    _hist *lat;
+
+    t0 = _now();
+    _bench_stack(n, recursive, NULL);
+    el = _now() - t0;
+    lat = histcreate();
+    ops = _bench_stack(n, recursive, lat);
+    _report("spush_spop", recursive ? "recursive" : "distinct", ops, el, lat);
+    histdestroy(lat);
+}
+
+static void
+_run_freelist(int n)
+{
+    long long ops, t0, el;
+    _hist *lat;
+
+    t0 = _now();
+    _bench_freelist(n, NULL);
+    el = _now() - t0;
+    lat = histcreate();
+    ops = _bench_freelist(n, lat);
+    _report("flget_flput", NULL, ops, el, lat);
+    histdestroy(lat);
+}
+
+int
+main(int argc, char **argv)
+{
+    int i, n;
+    uintptr_t *keys;
+    void **blocks;
+
+    n = BENCH_DEFAULT_N;
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (n <= 0) {
+        yerr("usage: %s [n]", argv[0]);
+        return 1;
+    }
+
+    keys = malloc(n * sizeof(uintptr_t));
+    blocks = malloc(n * sizeof(void *));
+    if (!keys || !blocks) {
+        yerr("malloc(%d) failed. No memory?", n);
+        return 1;
+    }
+
+    printf("{\n\"n\": %d,\n\"timer_overhead_ns\": %lld,\n\"benchmarks\": [", n,
+           _timer_overhead());
+
+    // live heap blocks of code object like sizes.
+    for(i=0; i<n; i++) {
+        blocks[i] = malloc(32 + (_rand() % 225));
+        keys[i] = (uintptr_t)blocks[i];
+    }
+    _run_htab(keys, n, "heap");
+    for(i=0; i<n; i++)
+        free(blocks[i]);
+
+    // densely packed objects of one size class.
+    for(i=0; i<n; i++)
+        keys[i] = (uintptr_t)0x7f0000001000ULL + (uintptr_t)i * ARENA_STRIDE;
+    _run_htab(keys, n, "arena");
+
+    _run_stack(n, 1);
+    _run_stack(n, 0);
+    _run_freelist(n);
+
+    printf("\n],\n\"hgrow\": [");
+    for(i=0; i<ngrows; i++)
+        printf("%s\n    {\"keys\": \"%s\", \"logsize\": %d, \"items\": %d, \"pause_ns\": %lld}",
+               i ? "," : "", grows[i].keys, grows[i].logsize, grows[i].items,
+               grows[i].pause);
+    printf("\n]\n}\n");
+
+    free(keys);
+    free(blocks);
+    YMEMLEAKCHECK();
+    return 0;
+}
@@ -0,0 +1,210 @@
+'''
+ benchoverhead.py
+ Measures the overhead of the profiler on representative workloads.
+
+ Every workload is run unprofiled, under cProfile and under each yappi
+ configuration. The median wall time of the repeats is reported with the
+ slowdown against the unprofiled run and the time it takes to read the
+ stats afterwards (get_stats() for yappi, building a pstats.Stats for
+ cProfile). cProfile only profiles the thread that enabled it, so its
+ "threads" row is not comparable.
+
+ usage:
+   python benchoverhead.py [-r repeats] [-o result.json] [workload ...]
+   python benchoverhead.py compare old.json new.json
+'''
+import gc
+import os
+import sys
+import json
+import time
+import shutil
+import getopt
+import pstats
+import tempfile
+import threading
+import cProfile
+import yappi
+
+DEFAULT_REPEATS = 5
+THREAD_COUNT = 8
+FUNC_COUNT = 3000
+STACK_DEPTH = 400
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def recursion():
+	for i in xrange(15):
+		fib(22)
+
+def builtins():
+	d = {"a": 1}
+	li = ["x", "y", "z"]
+	for i in xrange(150000):
+		len(li)
+		abs(-i)
+		min(i, 10)
+		d.get("a")
+		",".join(li)
+
+def threads():
+	ths = [threading.Thread(target=fib, args=(22,)) for i in xrange(THREAD_COUNT)]
+	for t in ths:
+		t.start()
+	for t in ths:
+		t.join()
+
+_funcs = []
+def _make_funcs():
+	ns = {}
+	for i in xrange(FUNC_COUNT):
+		exec "def f%d(x):\n\treturn x+1\n" % i in ns
+		_funcs.append(ns["f%d" % i])
+
+def many_funcs():
+	if not _funcs:
+		_make_funcs()
+	for i in xrange(100):
+		for f in _funcs:
+			f(i)
+
+def _leaf():
+	pass
+
+def _deep(n):
+	if n:
+		return _deep(n-1)
+	for i in xrange(200):
+		_leaf()
+
+def deep_stack():
+	for i in xrange(500):
+		_deep(STACK_DEPTH)
+
+WORKLOADS = [("recursion", recursion), ("builtins", builtins), ("threads", threads),
+			 ("many_funcs", many_funcs), ("deep_stack", deep_stack)]
+
+# name, yappi.start() kwargs. None is the unprofiled run, "cprofile" is cProfile.
+CONFIGS = [("none", None), ("cprofile", None), ("yappi", {}),
+		   ("yappi_builtins", {"builtins": True}),
+		   ("yappi_sample4", {"timing_sample": 4}),
+		   ("yappi_sample16", {"timing_sample": 16}),
+		   ("yappi_latency_hist", {"latency_hist": True}),
+		   ("yappi_deferred", {"deferred": True}),
+		   ("yappi_dedup", {"dedup_code": True}),
+		   ("yappi_max_memory", {"max_memory": 1<<20}),
+		   ("yappi_shm", {"shm_path": ""}),
+		   ("yappi_trace", {"trace_dir": ""})]
+
+def _run_yappi(fn, kwargs):
+	tmp = None
+	kwargs = dict(kwargs)
+	if "trace_dir" in kwargs:
+		tmp = tempfile.mkdtemp(prefix="yappibench")
+		kwargs["trace_dir"] = tmp
+	elif "shm_path" in kwargs:
+		fd, tmp = tempfile.mkstemp(prefix="yappibench")
+		os.close(fd)
+		kwargs["shm_path"] = tmp
+	try:
+		t0 = time.time()
+		yappi.start(**kwargs)
+		fn()
+		yappi.stop()
+		t1 = time.time()
+		yappi.get_stats(yappi.SORTTYPE_TTOTAL, yappi.SORTORDER_DESCENDING,
+						yappi.SHOW_ALL)
+		t2 = time.time()
+		yappi.clear_stats()
+	finally:
+		if tmp and os.path.isdir(tmp):
+			shutil.rmtree(tmp)
+		elif tmp and os.path.exists(tmp):
+			os.remove(tmp)
+	return t1 - t0, t2 - t1
+
+def _run_cprofile(fn):
+	pr = cProfile.Profile()
+	t0 = time.time()
+	pr.enable()
+	fn()
+	pr.disable()
+	t1 = time.time()
+	pstats.Stats(pr)
+	t2 = time.time()
+	return t1 - t0, t2 - t1
+
+def _run(fn, name, kwargs):
+	gc.collect()
+	if name == "none":
+		t0 = time.time()
+		fn()
+		return time.time() - t0, None
+	if name == "cprofile":
+		return _run_cprofile(fn)
+	return _run_yappi(fn, kwargs)
+
+def _median(li):
+	li = sorted(li)
+	return li[len(li)/2]
+
+def bench(workloads, repeats):
+	results = []
+	for wname, fn in WORKLOADS:
+		if workloads and wname not in workloads:
+			continue
+		fn() # warm up, creates the functions of many_funcs
+		base = None
+		for cname, kwargs in CONFIGS:
+			times = []
+			stimes = []
+			for i in xrange(repeats):
+				t, st = _run(fn, cname, kwargs)
+				times.append(t)
+				if st is not None:
+					stimes.append(st)
+			t = _median(times)
+			if base is None:
+				base = t
+			r = {"workload": wname, "config": cname, "seconds": round(t, 6),
+				 "min_seconds": round(min(times), 6),
+				 "slowdown": round(t / base, 3) if base else 0.0}
+			if stimes:
+				r["stats_ms"] = round(_median(stimes) * 1000, 3)
+			results.append(r)
+			sys.stderr.write("%-12s %-20s %10.4fs %8.2fx\n" % (wname, cname, t,
+							 r["slowdown"]))
+	return results
+
+def compare(old, new):
+	old = dict(((r["workload"], r["config"]), r) for r in old["results"])
+	for r in new["results"]:
+		o = old.get((r["workload"], r["config"]))
+		if not o or r["config"] == "none":
+			continue
+		print "%-12s %-20s %8.2fx -> %8.2fx" % (r["workload"], r["config"],
+												o["slowdown"], r["slowdown"])
+
+def main(argv):
+	if len(argv) == 3 and argv[0] == "compare":
+		compare(json.load(open(argv[1])), json.load(open(argv[2])))
+		return
+	opts, workloads = getopt.getopt(argv, "r:o:")
+	opts = dict(opts)
+	repeats = int(opts.get("-r", DEFAULT_REPEATS))
+	out = {"python": sys.version.split()[0], "platform": sys.platform,
+		   "repeats": repeats, "results": bench(workloads, repeats)}
+	s = json.dumps(out, sort_keys=True, indent=1,
+				   separators=(",", ": "))
+	if "-o" in opts:
+		f = open(opts["-o"], "w")
+		f.write(s + "\n")
+		f.close()
+	else:
+		print s
+
+if __name__ == "__main__":
+	main(sys.argv[1:])
@@ -0,0 +1,47 @@
+import os
+import glob
+import time
+import yappi
+import tempfile
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def slow():
+	time.sleep(0.05)
+
+d = tempfile.mkdtemp()
+yappi.set_slow_threshold(0.01, ['slow'])
+yappi.start()
+yappi.start_agent(d, interval=0.3, max_bytes=1)
+
+slow()
+t0 = time.time()
+while time.time() - t0 < 1.5:
+	fib(10)
+yappi.stop_agent()
+yappi.stop()
+
+# the disk budget keeps only the newest profile.
+paths = glob.glob(os.path.join(d, "yappi.*.ystat"))
+print len(paths)
+funcs, threads = yappi.load(paths[0])
+calls = [f[1] for f in funcs if ":fib:" in f[0]]
+print calls
+
+# the counters were reset after each profile, so the live stats hold only
+# the last interval.
+stats = {}
+def es(e):
+	stats[e[0]] = e[1]
+yappi.enum_stats(es)
+print [n for k, n in stats.items() if "fib" in k]
+# so is the slow call ring.
+print [e[1] for e in yappi.get_slow_calls() if ".slow:" in e[1]]
+yappi.clear_stats()
+
+yappi.start()
+yappi.start_agent(d, interval=10)
+# not stopped, the agent is stopped at exit.
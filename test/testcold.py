@@ -0,0 +1,67 @@
+import time
+import yappi
+
+_cache = {}
+def lookup(key):
+	if key not in _cache:
+		time.sleep(0.05) # lazy initialization
+		_cache[key] = key
+	return _cache[key]
+
+def run(**kwargs):
+	yappi.start(**kwargs)
+	for i in xrange(1000):
+		lookup(1)
+	yappi.stop()
+	stats = {}
+	def es(e):
+		stats[e[0].split(".")[-1].split(":")[0]] = e
+	yappi.enum_cold_stats(es)
+	yappi.clear_stats()
+	_cache.clear()
+	return stats.get("lookup")
+
+e = run()
+print e[1] >= 0.05 # first call
+print e[2] == 10 and e[3] >= 0.005
+print e[4] == 990 and e[5] < 0.001 # steady state is not skewed
+e = run(timing_sample=16, cold_calls=3)
+print e[1] >= 0.05 and e[2] == 3 and e[4] == 62 # every 16th of the 997
+
+def steady(i):
+	time.sleep(0.05 if i == 0 else 0.001)
+
+# only the sampled calls are steady ones, the average is taken over them.
+yappi.start(timing_sample=4, cold_calls=4)
+for i in xrange(100):
+	steady(i)
+yappi.stop()
+cold = []
+yappi.enum_cold_stats(lambda e: ".steady:" in e[0] and cold.append(e))
+print cold[0][4] == 24 and cold[0][5] >= 0.001 and cold[0][5] < 0.005
+yappi.clear_stats()
+
+# the agent starts the cold and steady counters over in every profile, the
+# calls after the first ones stay warm.
+import tempfile
+yappi.start()
+yappi.start_agent(tempfile.mkdtemp(), interval=0.2)
+lookup(3)
+t0 = time.time()
+while time.time() - t0 < 0.6:
+	steady(1)
+yappi.stop_agent()
+yappi.stop()
+names = []
+yappi.enum_cold_stats(lambda e: names.append(e[0]))
+print [n for n in names if ".lookup:" in n or ".steady:" in n] == []
+yappi.clear_stats()
+_cache.clear()
+print run(cold_calls=0) is None
+e = run(deferred=True)
+print e[1] >= 0.05 and e[2] == 10 and e[4] == 990
+yappi.start()
+lookup(2)
+yappi.stop()
+yappi.print_cold_stats()
+yappi.clear_stats()
@@ -0,0 +1,91 @@
+import time
+import ctypes
+import yappi
+
+# a cooperative scheduler running generator tasks on one thread.
+current = [0]
+def work():
+	time.sleep(0.01)
+
+def task(n):
+	for i in xrange(n):
+		work()
+		yield
+
+def schedule(tasks):
+	while tasks:
+		for tid, g in list(tasks):
+			current[0] = tid
+			try:
+				g.next()
+			except StopIteration:
+				tasks.remove((tid, g))
+			current[0] = 0
+
+# task 7 switches to the hub in the middle of a call and back.
+snapshot = []
+def hub():
+	work()
+	snapshot.extend(yappi.get_stats())
+
+def task7():
+	work()
+	current[0] = 0
+	hub()
+	current[0] = 7
+
+def run(cb):
+	yappi.set_context_id_callback(cb)
+	yappi.start()
+	schedule([(1, task(2)), (2, task(3)), (3, task(4))])
+	current[0] = 7
+	task7()
+	current[0] = 0
+	yappi.stop()
+	yappi.set_context_id_callback(None)
+
+	d = {}
+	def es(e):
+		d[e[0].split(".")[-1].split(":")[0]] = e
+	yappi.enum_stats(es)
+	print d["work"][1] == 11
+	# the generator tasks are done whenever they yield.
+	print [l for l in yappi.get_stats() if l.startswith("retired(")] != []
+	print [l for l in snapshot if l.split()[:2] == ["Task", "7"]] != []
+	# the hub is not a call made by task7, only work() is.
+	e = d["task7"]
+	print e[2] >= 0.02 and e[2] - e[3] < 0.015
+	del snapshot[:]
+	yappi.clear_stats()
+
+run(lambda: current[0])
+
+# a native callback in a capsule.
+CTXID = ctypes.CFUNCTYPE(ctypes.c_long)
+fn = CTXID(lambda: current[0])
+capsule_new = ctypes.pythonapi.PyCapsule_New
+capsule_new.restype = ctypes.py_object
+capsule_new.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+run(capsule_new(ctypes.cast(fn, ctypes.c_void_p), "yappi.context_id", None))
+
+# a failing callback falls back to the thread.
+def bad():
+	raise ValueError
+yappi.set_context_id_callback(bad)
+yappi.start()
+work()
+yappi.stop()
+yappi.set_context_id_callback(None)
+print len(yappi.get_stats()) > 0
+yappi.clear_stats()
+
+try:
+	yappi.set_context_id_callback(1)
+except yappi._yappi.error:
+	print True
+yappi.set_context_id_callback(lambda: 0)
+try:
+	yappi.start(deferred=True)
+except yappi._yappi.error:
+	print True
+yappi.set_context_id_callback(None)
@@ -0,0 +1,38 @@
+import gc
+import yappi
+import weakref
+
+SRC = "def render(x):\n\treturn x * 2\n"
+
+# every compile() creates a new code object for the same function.
+def run(n):
+	refs = []
+	for i in range(n):
+		ns = {}
+		exec compile(SRC, "template.py", "exec") in ns
+		ns["render"](i)
+		refs.append(weakref.ref(ns["render"].func_code))
+	return refs
+
+def renders():
+	calls = []
+	def es(e):
+		if "render" in e[0]:
+			calls.append(e[1])
+	yappi.enum_stats(es)
+	return calls
+
+yappi.start()
+refs = run(100)
+yappi.stop()
+gc.collect()
+print len(renders()), len([r for r in refs if r() is not None])
+yappi.clear_stats()
+
+yappi.start(dedup_code=True)
+refs = run(100)
+yappi.stop()
+gc.collect()
+print renders(), len([r for r in refs if r() is not None])
+yappi.print_stats(limit=3)
+yappi.clear_stats()
@@ -0,0 +1,49 @@
+import yappi
+import threading
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def loop():
+	for i in xrange(20000):
+		len("x")
+
+class worker(threading.Thread):
+	def run(self):
+		fib(15)
+		loop()
+
+def run():
+	ts = [worker() for i in range(4)]
+	for t in ts:
+		t.start()
+	fib(18)
+	for t in ts:
+		t.join()
+
+def collect():
+	stats = {}
+	def es(e):
+		stats[e[0]] = e[1]
+	yappi.enum_stats(es)
+	return stats
+
+yappi.start(True)
+run()
+yappi.stop()
+sync = collect()
+yappi.clear_stats()
+
+yappi.start(True, deferred=True)
+run()
+live = collect() # read while running, the queues are flushed.
+yappi.stop()
+deferred = collect()
+yappi.print_stats(limit=8)
+yappi.clear_stats()
+
+for name in sync:
+	if "fib" in name or "loop" in name or "<len>" in name:
+		print name, sync[name], deferred.get(name), sync[name] == deferred.get(name)
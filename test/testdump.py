@@ -0,0 +1,44 @@
+import os
+import yappi
+import tempfile
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def profile(path, n):
+	yappi.start(True)
+	fib(n)
+	yappi.stop()
+	yappi.save(path)
+	yappi.clear_stats()
+
+def ncall(funcs, name):
+	for f in funcs:
+		if (":%s:" % name) in f[0]:
+			return f[1]
+	return None
+
+d = tempfile.mkdtemp()
+p1 = os.path.join(d, "p1.prof")
+p2 = os.path.join(d, "p2.prof")
+out = os.path.join(d, "merged.prof")
+
+profile(p1, 15)
+profile(p2, 18)
+yappi.merge([p1, p2], out)
+
+f1, t1 = yappi.load(p1)
+f2, t2 = yappi.load(p2)
+fm, tm = yappi.load(out)
+print "fib calls:", ncall(f1, "fib"), ncall(f2, "fib"), ncall(fm, "fib")
+print ncall(f1, "fib") + ncall(f2, "fib") == ncall(fm, "fib")
+print "threads:", len(t1), len(t2), len(tm)
+for f in sorted(fm, key=lambda f: f[2], reverse=True)[:5]:
+	print f
+
+try:
+	yappi.load(__file__)
+except yappi._yappi.error, e:
+	print "invalid profile:", e
@@ -0,0 +1,40 @@
+import os
+import yappi
+import pstats
+import tempfile
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def loop():
+	for i in xrange(50000):
+		pass
+
+yappi.start(True)
+fib(16)
+loop()
+yappi.stop()
+
+d = tempfile.mkdtemp()
+pp = os.path.join(d, "yappi.pstat")
+cp = os.path.join(d, "yappi.callgrind")
+yappi.save(pp, type="pstat")
+yappi.save(cp, type="callgrind")
+yappi.clear_stats()
+
+ps = pstats.Stats(pp)
+ps.sort_stats("time").print_stats(5)
+for k, v in ps.stats.items():
+	if k[2] == "fib":
+		print k, v[0], v[1]
+
+print open(cp).read()[:400]
+
+try:
+	yappi.start()
+	yappi.stop()
+	yappi.save(pp, type="xml")
+except yappi._yappi.error, e:
+	print e
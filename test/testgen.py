@@ -0,0 +1,69 @@
+import time
+import yappi
+
+def gen(n):
+	for i in xrange(n):
+		time.sleep(0.01)
+		yield i
+
+def consume(n):
+	for v in gen(n):
+		time.sleep(0.02)
+
+def run(**kwargs):
+	yappi.start(**kwargs)
+	consume(5)
+	consume(5)
+	g = gen(5) # left suspended, never finished
+	g.next()
+	yappi.stop()
+
+	stats = {}
+	def es(e):
+		stats[e[0].split(".")[-1].split(":")[0]] = e
+	yappi.enum_generator_stats(es)
+	e = stats["gen"]
+	print e[1] == 3 # calls
+	print e[2] == 10 # resumes: 5 values and the final return of each loop
+	print e[4] == 2 # finished
+	print e[3] >= 0.1 and e[3] < 0.2 # active time only
+	print e[5] >= 0.3 # includes the time suspended
+	print "consume" not in stats
+	yappi.clear_stats()
+
+run()
+run(deferred=True)
+yappi.start()
+consume(2)
+yappi.stop()
+yappi.print_generator_stats()
+yappi.clear_stats()
+
+# the generator counters start over in every agent profile.
+import tempfile
+yappi.start()
+yappi.start_agent(tempfile.mkdtemp(), interval=0.2)
+consume(2)
+t0 = time.time()
+while time.time() - t0 < 0.6:
+	time.sleep(0.01)
+yappi.stop_agent()
+yappi.stop()
+names = []
+yappi.enum_generator_stats(lambda e: names.append(e[0]))
+print [n for n in names if ".gen:" in n] == []
+yappi.clear_stats()
+
+# a generator started before the profiler is counted as a call when it is
+# first resumed.
+g = gen(3)
+g.next()
+yappi.start()
+for v in g:
+	pass
+yappi.stop()
+stats = {}
+yappi.enum_stats(lambda e: stats.__setitem__(e[0].split(".")[-1].split(":")[0], e))
+print stats["gen"][1] == 1
+print [l for l in yappi.get_stats() if "inf" in l] == []
+yappi.clear_stats()
@@ -0,0 +1,28 @@
+import time
+import yappi
+
+def fast():
+	pass
+
+def slow(i):
+	if i % 10 == 0:
+		time.sleep(0.01)
+
+def estat(entry):
+	print "%s, %d, %0.6f, %0.6f, %0.6f, %0.6f" % entry
+
+yappi.start(latency_hist=['slow'])
+for i in xrange(100):
+	fast()
+	slow(i)
+yappi.stop()
+yappi.enum_latency_stats(estat)
+yappi.print_latency_stats()
+yappi.clear_stats()
+
+yappi.start(True, latency_hist=True)
+for i in xrange(1000):
+	fast()
+yappi.stop()
+yappi.print_latency_stats()
+yappi.clear_stats()
@@ -1,31 +1,84 @@
+/*
+*    Native hash table test, build with:
+*        cc -I.. -o testhtab testhtab.c ymemstub.c ../_yhashtab.c
+*/
+
 #include "_yhashtab.h"
+#include "_ymem.h"
+
+#define KEY_COUNT 5000
+#define KEY_STRIDE 48 // keys look like heap addresses
+
+static int failed = 0;
+
+#define CHECK(c) do { if (!(c)) { \
+    yerr("check failed at line %d: %s", __LINE__, #c); failed = 1; } } while(0)
+
+static uintptr_t
+_key(int i)
+{
+    return (uintptr_t)0x7f0000001000ULL + (uintptr_t)i * KEY_STRIDE;
+}
 
 int
 main(void)
 {
+    int i, logsize;
     _htab *ht;
-    _hitem *it, *it1, *it2;
+    _hitem *it, *it1;
 
     ht = htcreate(1);
+    CHECK(ht != NULL);
 
-
-    hadd(ht, 1, 1);
-    hadd(ht, 2, 2);
-    hadd(ht, 4, 4);
+    CHECK(hadd(ht, 1, 1));
+    CHECK(hadd(ht, 2, 2));
+    CHECK(hadd(ht, 4, 4));
+    CHECK(!hadd(ht, 4, 5)); // duplicate
 
     it = hfind(ht, 1);
     it1 = hfind(ht, 2);
-    hadd(ht, 5, 5);
+    CHECK(it && it->key == 1 && it->val == 1);
+    CHECK(it1 && it1->key == 2 && it1->val == 2);
+    CHECK(hadd(ht, 5, 5));
 
-    hfree(ht, it);
-    hfree(ht, it1);
+    // hadd may grow the table, find the items again before freeing.
+    hfree(ht, hfind(ht, 1));
+    hfree(ht, hfind(ht, 2));
+    CHECK(hfind(ht, 1) == NULL);
+    CHECK(hfind(ht, 2) == NULL);
+    CHECK(hfind(ht, 5) != NULL);
+    CHECK(hcount(ht) == 2);
 
-    hsanity(ht);
-    hfind(ht, 5);
-    hfind(ht, 5);
+    // freed items are recycled.
+    CHECK(hadd(ht, 1, 10));
+    it = hfind(ht, 1);
+    CHECK(it && it->val == 10);
+    htdestroy(ht);
 
-    hdisp(ht);
+    // keys must survive growing, pointers must not be truncated.
+    ht = htcreate(1);
+    logsize = ht->logsize;
+    for(i=0; i<KEY_COUNT; i++)
+        CHECK(hadd(ht, _key(i), i));
+    CHECK(ht->logsize > logsize);
+    CHECK(hcount(ht) == KEY_COUNT);
+    for(i=0; i<KEY_COUNT; i++) {
+        it = hfind(ht, _key(i));
+        CHECK(it && it->key == _key(i) && it->val == (uintptr_t)i);
+    }
+    if (sizeof(uintptr_t) > 4)
+        CHECK(hfind(ht, _key(0) & 0xFFFFFFFF) == NULL);
+    for(i=0; i<KEY_COUNT; i+=2)
+        hfree(ht, hfind(ht, _key(i)));
+    CHECK(hcount(ht) == KEY_COUNT/2);
+    for(i=0; i<KEY_COUNT; i++)
+        CHECK((hfind(ht, _key(i)) != NULL) == (i % 2));
     htdestroy(ht);
 
+    YMEMLEAKCHECK();
+    CHECK(ymemusage() == 0);
+    if (failed)
+        return 1;
+    printf("testhtab: ok\n");
     return 0;
 }
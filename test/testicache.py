@@ -0,0 +1,39 @@
+import gc
+import yappi
+
+def a():
+	pass
+
+def b():
+	pass
+
+yappi.start(True)
+for i in xrange(10000):
+	a()
+	b()
+	len("x")
+yappi.stop()
+st = yappi.get_icache_stats()
+print st["hits"] > 10 * st["misses"], st["misses"] < 100
+
+calls = {}
+def es(e):
+	calls[e[0].split(".")[-1]] = e[1]
+yappi.enum_stats(es)
+print calls["a:4"], calls["b:7"], calls["<len>"]
+yappi.clear_stats()
+
+# in dedup mode a dead code object may leave its address to a new one,
+# cached entries of it are dropped.
+yappi.start(dedup_code=True)
+for i in range(200):
+	ns = {}
+	exec "def f%d(): pass" % (i % 3) in ns
+	ns["f%d" % (i % 3)]()
+	del ns
+	gc.collect()
+yappi.stop()
+calls = {}
+yappi.enum_stats(es)
+print sorted([(k, n) for k, n in calls.items() if k.startswith("f")])
+yappi.clear_stats()
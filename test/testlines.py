@@ -0,0 +1,80 @@
+import time
+import yappi
+
+def handler(n):
+	total = 0
+	for i in xrange(n):
+		total += i
+	time.sleep(0.05)
+	return total
+
+def other(n):
+	for i in xrange(n):
+		pass
+
+yappi.start(line_profile=["handler"])
+for i in xrange(3):
+	handler(100)
+	other(100)
+yappi.stop()
+
+lines = {}
+def es(e):
+	lines[(e[0].split(".")[-1], e[2])] = e
+yappi.enum_line_stats(es)
+first = handler.func_code.co_firstlineno
+print sorted(set(k[0] for k in lines)) == ["handler:%d" % first]
+print lines[("handler:%d" % first, first+1)][3] == 3
+print lines[("handler:%d" % first, first+3)][3] == 300
+print lines[("handler:%d" % first, first+4)][4] >= 0.14
+yappi.print_line_stats()
+yappi.clear_stats()
+
+# no line tracing is left behind once the function returns.
+import sys
+yappi.start(line_profile=["handler"])
+handler(1)
+yappi.stop()
+print sys.gettrace() is None
+yappi.clear_stats()
+
+# the line stats start over with the other counters in every agent profile.
+import tempfile
+yappi.start(line_profile=["handler"])
+yappi.start_agent(tempfile.mkdtemp(), interval=0.2)
+handler(100)
+t0 = time.time()
+while time.time() - t0 < 0.6:
+	other(100)
+yappi.stop_agent()
+yappi.stop()
+hits = []
+yappi.enum_line_stats(lambda e: hits.append(e[3]))
+print sum(hits) == 0
+yappi.clear_stats()
+
+# a thread stopped in the middle of a line profiled function untraces itself
+# and is line profiled again once restarted.
+import threading
+go = threading.Event()
+done = threading.Event()
+def spin():
+	while not done.is_set():
+		go.set()
+		handler(10)
+t = threading.Thread(target=spin)
+yappi.start(line_profile=["handler"])
+t.start()
+go.wait()
+yappi.stop()
+time.sleep(0.1)
+yappi.clear_stats()
+yappi.start(line_profile=["handler"])
+time.sleep(0.2)
+yappi.stop()
+done.set()
+t.join()
+hits = []
+yappi.enum_line_stats(lambda e: hits.append(e[3]))
+print sum(hits) > 0
+yappi.clear_stats()
@@ -0,0 +1,49 @@
+import yappi
+
+# every generated function has its own code object.
+funcs = []
+for i in range(3000):
+	exec "def f%d(): pass" % i
+	funcs.append(eval("f%d" % i))
+
+def run():
+	for f in funcs:
+		f()
+
+yappi.start()
+run()
+yappi.stop()
+unbounded = yappi.get_mem_stats()
+yappi.clear_stats()
+
+yappi.start(max_memory=unbounded["usage"] / 2)
+run()
+yappi.stop()
+bounded = yappi.get_mem_stats()
+print unbounded["folded_calls"], bounded["folded_calls"] > 0
+print bounded["pits"] < unbounded["pits"]
+print bounded["usage"] < unbounded["usage"]
+
+other = []
+def es(e):
+	if e[0] == "<other>":
+		other.append(e[1])
+yappi.enum_stats(es)
+print other == [bounded["folded_calls"]]
+yappi.clear_stats()
+
+# trace mode resolves the pit on returns too, they are not folded calls.
+import tempfile
+yappi.start(max_memory=unbounded["usage"] / 2, trace_dir=tempfile.mkdtemp())
+run()
+yappi.stop()
+other = []
+yappi.enum_stats(es)
+print other == [yappi.get_mem_stats()["folded_calls"]]
+yappi.clear_stats()
+
+# every allocation is accounted to one subsystem.
+sub = unbounded["subsystems"]
+print sum(s["usage"] for s in sub.values()) == unbounded["usage"]
+print unbounded["peak"] >= unbounded["usage"], sub["pits"]["usage"] > sub["contexts"]["usage"]
+print sub["hashtables"]["peak"] >= sub["hashtables"]["usage"] > 0, sub["callstacks"]["usage"] > 0
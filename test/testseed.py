@@ -0,0 +1,54 @@
+import time
+import threading
+import yappi
+
+def work():
+	time.sleep(0.01)
+
+def loop(n):
+	for i in xrange(n):
+		work()
+
+def stat(name):
+	stats = {}
+	def es(e):
+		stats[e[0].split(".")[-1].split(":")[0]] = e
+	yappi.enum_stats(es)
+	return stats[name]
+
+# a thread that is already running loop() when the profiler starts.
+started = threading.Event()
+done = threading.Event()
+def worker():
+	started.set()
+	loop(20)
+	done.set()
+
+t = threading.Thread(target=worker)
+t.start()
+started.wait()
+time.sleep(0.05)
+yappi.start()
+done.wait()
+t.join()
+yappi.stop()
+e = stat("loop")
+print e[1] == 1
+print e[2] >= 0.1 and e[2] < 0.2 # accounted from start on
+e = stat("worker")
+print e[1] == 1 and e[2] >= 0.1
+yappi.clear_stats()
+
+# the thread that starts the profiler.
+def attach(**kwargs):
+	loop(5)
+	yappi.start(**kwargs)
+	loop(5)
+
+for kwargs in ({}, {"deferred": True}):
+	attach(**kwargs)
+	yappi.stop()
+	e = stat("attach")
+	print e[1] == 1 and e[2] >= 0.05 and e[2] < 0.1
+	print yappi.get_profiler_stats()["stack_underflows"] == 0
+	yappi.clear_stats()
@@ -0,0 +1,42 @@
+import threading
+import yappi
+
+def a(n):
+	if n:
+		a(n-1)
+
+def t():
+	for i in xrange(100):
+		a(5)
+
+yappi.start(True)
+for i in xrange(1000):
+	a(10)
+	len("x")
+th = threading.Thread(target=t)
+th.start()
+th.join()
+yappi.stop()
+st = yappi.get_profiler_stats()
+ev = st["events"]
+print ev["call"] >= 11000, ev["return"] >= 11000, ev["c_call"] >= 1000, ev["c_return"] >= 1000
+print st["callback_samples"] > 0, st["callback_time"] >= 0
+tb = st["tables"]
+print tb["pits"]["lookups"] > 0, tb["pits"]["probes"] > 0, tb["contexts"]["lookups"] >= ev["call"]
+print tb["callstacks"]["lookups"] >= 2 * ev["call"]
+print st["context_switches"] >= 2, st["stack_underflows"] >= 0
+
+# the pits table grows after 768 functions
+ns = {}
+for i in xrange(1000):
+	exec "def f%d():\n\tpass\n" % i in ns
+yappi.start()
+for i in xrange(1000):
+	ns["f%d" % i]()
+yappi.stop()
+st = yappi.get_profiler_stats()
+print st["tables"]["pits"]["grows"] >= 1, st["tables"]["pits"]["grow_time"] >= 0
+
+yappi.clear_stats()
+st = yappi.get_profiler_stats()
+print st["events"]["call"] == 0, st["tables"]["pits"]["lookups"] == 0, st["context_switches"] == 0
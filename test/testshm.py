@@ -0,0 +1,53 @@
+import os
+import sys
+import yappi
+import tempfile
+import threading
+import subprocess
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+def loop():
+	for i in xrange(50000):
+		pass
+
+path = os.path.join(tempfile.mkdtemp(), "yappi.shm")
+yappi.start(True, shm_path=path)
+t = threading.Thread(target=loop)
+t.start()
+fib(16)
+t.join()
+
+# read the live stats from another process while still profiling.
+out = subprocess.Popen([sys.executable, "-c",
+	"import yappi; info, funcs, threads = yappi.read_shm(%r); "
+	"print info['running'], len(threads), "
+	"[f[1] for f in funcs if ':fib:' in f[0]]" % path],
+	stdout=subprocess.PIPE, env=os.environ).communicate()[0]
+print "live:", out.strip()
+
+yappi.stop()
+stats = {}
+def es(e):
+	stats[e[0]] = e[1]
+yappi.enum_stats(es)
+
+info, funcs, threads = yappi.read_shm(path)
+print "running:", info["running"], "pid ok:", info["pid"] == os.getpid()
+for name, ncall, ttot, tsub in funcs:
+	if ":fib:" in name or ":loop:" in name:
+		print name.split(":")[1], ncall, ttot >= tsub
+print [t[0] for t in threads]
+yappi.clear_stats()
+
+# a record left with an odd sequence by a writer that died is skipped.
+import struct
+torn = os.path.join(tempfile.mkdtemp(), "torn.shm")
+data = bytearray(open(path, "rb").read())
+struct.pack_into("=I", data, struct.calcsize("=8s6Iqqd2I"), 1)
+open(torn, "wb").write(data)
+tinfo, tfuncs, tthreads = yappi.read_shm(torn)
+print tinfo["torn"] == 1 and len(tfuncs) == len(funcs) - 1
@@ -0,0 +1,29 @@
+import os
+import glob
+import yappi
+import signal
+import tempfile
+
+def fib(n):
+	if n < 2:
+		return n
+	return fib(n-1) + fib(n-2)
+
+d = tempfile.mkdtemp()
+yappi.install_signal_handlers(dump_path=os.path.join(d, "yappi.%(pid)d.prof"),
+	builtins=True)
+
+os.kill(os.getpid(), signal.SIGUSR1)
+print "running:", yappi.is_running()
+fib(15)
+os.kill(os.getpid(), signal.SIGUSR2)
+os.kill(os.getpid(), signal.SIGUSR1)
+print "running:", yappi.is_running()
+
+paths = glob.glob(os.path.join(d, "*.prof"))
+funcs, threads = yappi.load(paths[0])
+print len(paths), [f[1] for f in funcs if ":fib:" in f[0]]
+
+yappi.uninstall_signal_handlers()
+print signal.getsignal(signal.SIGUSR1) == signal.SIG_DFL
+yappi.clear_stats()
@@ -0,0 +1,46 @@
+import time
+import yappi
+
+def leaf(i):
+	if i == 7:
+		time.sleep(0.05)
+
+def mid(i):
+	leaf(i)
+
+def top():
+	for i in xrange(10):
+		mid(i)
+
+def other():
+	time.sleep(0.02)
+
+yappi.set_slow_threshold(0.03)
+yappi.start()
+top()
+other()
+yappi.stop()
+yappi.print_slow_calls()
+yappi.clear_stats()
+
+yappi.set_slow_threshold(0)
+yappi.set_slow_threshold(0.01, ['other'])
+yappi.start()
+top()
+other()
+yappi.stop()
+for e in yappi.get_slow_calls():
+	print e
+yappi.clear_stats()
+
+# a per function threshold of 0 exempts it from the global one.
+yappi.set_slow_threshold(0.01)
+yappi.set_slow_threshold(0, ['top', 'mid', 'leaf'])
+yappi.start()
+top()
+other()
+yappi.stop()
+print [e[1] for e in yappi.get_slow_calls()
+	if e[1].startswith("testslow")] == ['testslow.py.other:15']
+yappi.clear_stats()
+yappi.set_slow_threshold(0)
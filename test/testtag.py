@@ -0,0 +1,92 @@
+import time
+import threading
+import yappi
+
+def query(n):
+	time.sleep(n)
+
+def handler(endpoint, n):
+	yappi.set_tag(endpoint)
+	for i in xrange(n):
+		query(0.01)
+	yappi.set_tag(None)
+
+def stats(tag=None):
+	d = {}
+	def es(e):
+		d[e[0].split(".")[-1].split(":")[0]] = e
+	yappi.enum_stats(es, tag)
+	return d
+
+def run(**kwargs):
+	yappi.start(**kwargs)
+	handler("/users", 3)
+	handler("/orders", 5)
+	t = threading.Thread(target=handler, args=("/users", 2))
+	t.start()
+	t.join()
+	query(0)
+	yappi.stop()
+
+	e = stats("/users")["query"]
+	print e[1] == 5 and e[2] >= 0.05 and e[2] < 0.08
+	e = stats("/orders")["query"]
+	print e[1] == 5 and e[2] >= 0.05
+	print stats("/none") == {}
+	li = []
+	yappi.enum_stats(li.append)
+	print sorted((e[0].split(":5")[1], e[1]) for e in li if ".query:5" in e[0]) == \
+		[("", 1), (" [/orders]", 5), (" [/users]", 5)]
+	print len(yappi.get_stats(tag="/orders")) < len(yappi.get_stats())
+	yappi.clear_stats()
+
+run()
+run(deferred=True)
+run(dedup_code=True)
+
+# the code objects compiled here die right away and their addresses are
+# reused by the next ones, which must not be taken for them.
+yappi.start(dedup_code=True)
+yappi.set_tag("t")
+for i in xrange(200):
+	exec compile("def f%d(): pass\nf%d()\n" % (i % 4, i % 4), "gen%d.py" % (i % 4), "exec")
+yappi.set_tag(None)
+yappi.stop()
+d = {}
+yappi.enum_stats(lambda e: d.__setitem__(e[0], e[1]), "t")
+print d["gen0.py.<module>:1 [t]"] == 50 and d["gen0.py.f0:1 [t]"] == 50
+yappi.clear_stats()
+# the saved profiles keep the tagged calls apart.
+import os
+import marshal
+import tempfile
+yappi.start()
+handler("a", 3)
+handler("b", 5)
+query(0)
+yappi.stop()
+d = tempfile.mkdtemp()
+yappi.save(os.path.join(d, "p.pstat"), "pstat")
+pstat = marshal.load(open(os.path.join(d, "p.pstat"), "rb"))
+print sorted((k[2], v[1]) for k, v in pstat.items() if k[2].startswith("query")) == \
+	[("query", 1), ("query [a]", 3), ("query [b]", 5)]
+yappi.save(os.path.join(d, "p.ystat"))
+funcs, threads = yappi.load(os.path.join(d, "p.ystat"))
+print sorted(f[1] for f in funcs if ":query:" in f[0]) == [1, 3, 5]
+yappi.merge([os.path.join(d, "p.ystat")] * 2, os.path.join(d, "m.ystat"))
+funcs, threads = yappi.load(os.path.join(d, "m.ystat"))
+print sorted(f[1] for f in funcs if ":query:" in f[0]) == [2, 6, 10]
+yappi.save(os.path.join(d, "p.callgrind"), "callgrind")
+print sorted(l for l in open(os.path.join(d, "p.callgrind")) if l.startswith("fn=query")) == \
+	["fn=query:5\n", "fn=query:5 [a]\n", "fn=query:5 [b]\n"]
+yappi.clear_stats()
+
+yappi.set_tag("x") # not profiled, nothing happens
+try:
+	yappi.start()
+	yappi.set_tag([])
+except TypeError:
+	print True
+yappi.stop()
+yappi.print_stats(tag="/none")
+yappi.clear_stats()
@@ -0,0 +1,36 @@
+import yappi
+import threading
+
+def work():
+	for i in xrange(1000):
+		pass
+
+def run(n):
+	for i in range(n):
+		t = threading.Thread(target=work)
+		t.start()
+		t.join()
+
+yappi.start()
+run(200)
+yappi.stop()
+
+# exited threads are folded into a single retired line instead of being
+# merged into the thread that reuses their thread state.
+stats = yappi.get_stats()
+threads = [l for l in stats if l.startswith("Thread") or l.startswith("retired")]
+print len(threads), threads[-1].split()[0]
+
+calls = {}
+def es(e):
+	calls[e[0]] = e[1]
+yappi.enum_stats(es)
+print [n for k, n in calls.items() if ".work:" in k]
+yappi.clear_stats()
+
+# threads exiting after clear_stats() do not touch the new contexts.
+yappi.start()
+run(10)
+yappi.stop()
+yappi.print_stats(limit=2)
+yappi.clear_stats()
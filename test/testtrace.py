@@ -0,0 +1,42 @@
+import os
+import json
+import tempfile
+import threading
+import yappi
+
+def foo():
+	pass
+
+def bar():
+	for i in xrange(3):
+		foo()
+
+class worker(threading.Thread):
+	def run(self):
+		bar()
+
+d = tempfile.mkdtemp()
+yappi.start(True, trace_dir=d, trace_size=1024)
+bar()
+# the names are readable before stop(), so a crashed process keeps them.
+print "bar" in open(os.path.join(d, "yappi.names")).read()
+t = worker()
+t.start()
+t.join()
+yappi.stop()
+print sorted(os.listdir(d))
+
+out = os.path.join(d, "trace.json")
+yappi.convert_trace(d, out)
+events = json.load(open(out))["traceEvents"]
+print len(events), "events"
+for e in events[:12]:
+	print e["tid"], e["ph"], e.get("name")
+yappi.clear_stats()
+
+# a trace without records still converts into a valid, empty file.
+d = tempfile.mkdtemp()
+open(os.path.join(d, "yappi.names"), "w").close()
+out = os.path.join(d, "trace.json")
+yappi.convert_trace(d, out)
+print json.load(open(out))["traceEvents"] == []
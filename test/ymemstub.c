@@ -0,0 +1,44 @@
+/*
+*    malloc backed ytmalloc for building the core data structures without
+*    Python, see testhtab.c and benchcore.c.
+*/
+
+#include "_ymem.h"
+
+static unsigned long memused=0;
+
+void *
+ytmalloc(size_t size, int tag)
+{
+    void *p;
+
+    p = malloc(size+sizeof(size_t));
+    if (!p) {
+        yerr("malloc(%d) failed. No memory?", (int)size);
+        return NULL;
+    }
+    memused += size;
+    *(size_t *)p = size;
+    return (char *)p+sizeof(size_t);
+}
+
+void
+yfree(void *p)
+{
+    p = (char *)p - sizeof(size_t);
+    memused -= *(size_t *)p;
+    free(p);
+}
+
+unsigned long
+ymemusage(void)
+{
+    return memused;
+}
+
+void
+YMEMLEAKCHECK(void)
+{
+    if (memused)
+        yerr("leaking %lu bytes.", memused);
+}
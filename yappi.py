@@ -6,11 +6,22 @@
  Sumer Cip 2010
 
 '''
+import os
 import sys
+import time
 import threading
+import linecache
 import _yappi
 
-__all__ = ['start', 'stop', 'enum_stats', 'print_stats', 'clear_stats']
+__all__ = ['start', 'stop', 'enum_stats', 'print_stats', 'clear_stats',
+		   'enum_latency_stats', 'print_latency_stats', 'set_slow_threshold',
+		   'get_slow_calls', 'print_slow_calls', 'convert_trace', 'save', 'load',
+		   'merge', 'read_shm', 'is_running', 'install_signal_handlers',
+		   'uninstall_signal_handlers', 'start_agent', 'stop_agent', 'get_mem_stats',
+		   'get_icache_stats', 'get_profiler_stats', 'enum_line_stats',
+		   'print_line_stats', 'enum_generator_stats', 'print_generator_stats',
+		   'enum_cold_stats', 'print_cold_stats', 'set_tag',
+		   'set_context_id_callback']
 
 SORTTYPE_NAME = _yappi.SORTTYPE_NAME
 SORTTYPE_NCALL = _yappi.SORTTYPE_NCALL
@@ -20,6 +31,7 @@ SORTTYPE_TAVG = _yappi.SORTTYPE_TAVG
 SORTORDER_ASCENDING = _yappi.SORTORDER_ASCENDING
 SORTORDER_DESCENDING = _yappi.SORTORDER_DESCENDING
 SHOW_ALL = _yappi.SHOW_ALL
+SHM_READ_RETRIES = 10000 # read_shm() gives up on a record torn for longer
 
 '''
  __callback will only be called once per-thread. _yappi will detect
@@ -36,34 +48,474 @@ builtins: If set true, then builtin functions are profiled too.
 timing_sample: will cause the profiler to do timing measuresements
                according to the value. Will increase profiler speed but
                decrease accuracy.
+latency_hist: If set true, a latency histogram of the per-call durations
+              is kept for every function. A list of function names limits
+              the histograms to those functions. See enum_latency_stats().
+trace_dir: If set, no stats are aggregated. Instead every call/return event
+           is appended to a per-thread ring file in this directory. See
+           convert_trace().
+trace_size: Number of events the ring file of a thread holds before the
+            oldest events are overwritten.
+deferred: If set true, the profiler hook only queues the events and a native
+          background thread does the accounting. Stats are brought up to
+          date whenever they are read.
+shm_path: If set, the stats are also published live into a shared memory
+          mapped file at this path which other processes can read with
+          read_shm() without calling into this one.
+max_memory: If set, the memory budget of the profiler in bytes. Once it is
+            reached, calls of functions that are not profiled yet are
+            counted in a single "<other>" function. See get_mem_stats().
+dedup_code: If set true, functions are identified by their filename, name and
+            first line instead of their code object, so code generated again
+            and again (templates, exec) shares the stats of a single
+            function and the code objects are not kept alive by the profiler.
+line_profile: A list of function names whose lines are profiled too. Lines are
+              only traced while one of these functions runs, other code is
+              not slowed down further. See enum_line_stats().
+cold_calls: Number of first calls of every function that are timed apart
+            from the steady state, regardless of timing_sample. See
+            enum_cold_stats().
 '''
-def start(builtins = False, timing_sample=1):
+def start(builtins = False, timing_sample=1, latency_hist=False,
+		  trace_dir=None, trace_size=1<<18, deferred=False, shm_path=None,
+		  max_memory=0, dedup_code=False, line_profile=None, cold_calls=10):
 	threading.setprofile(__callback)
-	_yappi.start(builtins, timing_sample)
+	_yappi.start(builtins, timing_sample, latency_hist, trace_dir, trace_size,
+				 deferred, shm_path, max_memory, dedup_code, line_profile,
+				 cold_calls)
 
 def stop():
 	threading.setprofile(None)
 	_yappi.stop()
 
-def enum_stats(fenum):
-	_yappi.enum_stats(fenum)
+def is_running():
+	return _yappi.is_running()
+
+'''
+ Returns a dict with the memory used by the profiler (usage) and its high-water
+ mark since the stats were last cleared (peak), the budget set in start()
+ (max_memory), the calls folded into "<other>" because of it (folded_calls),
+ the number of profiled functions and threads, and the usage and peak of each
+ subsystem (pits, contexts, hashtables, callstacks, stats, other).
+'''
+def get_mem_stats():
+	return _yappi.get_mem_stats()
+
+'''
+ Returns the hits and misses of the per-thread caches that map the called
+ code to its function stats, summed over all threads.
+'''
+def get_icache_stats():
+	return _yappi.get_icache_stats()
+
+'''
+ Returns counters of the profiler itself since the stats were last cleared:
+ the events handled by type, the time spent in the profiler hook (estimated
+ from a sample of the events), lookups, probes and grows of the internal
+ hash tables, grows of the callstacks and freelists, returns seen with an
+ empty callstack and the switches between threads.
+'''
+def get_profiler_stats():
+	return _yappi.get_profiler_stats()
+
+'''
+ fenum is called with a (name, ncall, ttot, tsub) tuple for every function.
+ If tag is given, only the calls made under that tag are enumerated,
+ otherwise the functions are enumerated once per tag. See set_tag().
+'''
+def enum_stats(fenum, tag=None):
+	_yappi.enum_stats(fenum, tag)
+
+'''
+ fenum is called with a (name, ncall, p50, p90, p99, max) tuple for every
+ function that has a latency histogram. Durations are in seconds.
+'''
+def enum_latency_stats(fenum):
+	_yappi.enum_latency_stats(fenum)
 
 def get_stats(sorttype=_yappi.SORTTYPE_NCALL,
 			  sortorder=_yappi.SORTORDER_DESCENDING,
-			  limit=_yappi.SHOW_ALL):
-	return _yappi.get_stats(sorttype, sortorder, limit)
+			  limit=_yappi.SHOW_ALL, tag=None):
+	return _yappi.get_stats(sorttype, sortorder, limit, tag)
 
 def print_stats(sorttype=_yappi.SORTTYPE_NCALL,
 				sortorder=_yappi.SORTORDER_DESCENDING,
-				limit=_yappi.SHOW_ALL):
-	li = get_stats(sorttype, sortorder, limit)
+				limit=_yappi.SHOW_ALL, tag=None):
+	li = get_stats(sorttype, sortorder, limit, tag)
 	for it in li:
 		print it
 
+def print_latency_stats():
+	li = []
+	enum_latency_stats(li.append)
+	li.sort(key=lambda e: e[4], reverse=True)
+	print "\n\nname                                 #n       p50        p90        p99        max"
+	for e in li:
+		print "%-36.36s %-8d %-10.6f %-10.6f %-10.6f %-10.6f" % e
+
+'''
+ fenum is called with a (name, filename, line, hits, ttot) tuple for every
+ executed line of the functions given to start(line_profile=...). ttot is the
+ time in seconds from the start of the line to the start of the next one,
+ including the calls made on the line.
+'''
+def enum_line_stats(fenum):
+	_yappi.enum_line_stats(fenum)
+
+def print_line_stats():
+	li = []
+	enum_line_stats(li.append)
+	li.sort(key=lambda e: (e[0], e[2]))
+	name = None
+	for e in li:
+		if e[0] != name:
+			name = e[0]
+			print "\n\n%s\n\nline     #n       ttot       source" % name
+		print "%-8d %-8d %-10.6f %s" % (e[2], e[3], e[4],
+										linecache.getline(e[1], e[2]).rstrip())
+
+'''
+ fenum is called with a (name, ncall, nresume, ttot, nfinished, tlife) tuple
+ for every generator function. A generator call is counted once, resuming
+ it after a yield only counts in nresume. ttot is the time spent running the
+ generator, tlife is the time from the call to the end of the nfinished
+ generators that ran to completion, including the time they were suspended.
+'''
+def enum_generator_stats(fenum):
+	_yappi.enum_generator_stats(fenum)
+
+def print_generator_stats():
+	li = []
+	enum_generator_stats(li.append)
+	li.sort(key=lambda e: e[3], reverse=True)
+	print "\n\nname                                 #n       #resume    ttot       #done    tlife"
+	for e in li:
+		print "%-36.36s %-8d %-10d %-10.6f %-8d %-10.6f" % e
+
+'''
+ fenum is called with a (name, first, ncold, cold_avg, nsteady, steady_avg)
+ tuple for every function. first is the duration of the first call, cold_avg
+ the average of the first ncold calls (see start(cold_calls=...)) and
+ steady_avg the average of the nsteady calls after them that finished and
+ were timed, only every timing_sample-th one with start(timing_sample=...).
+ Durations are in seconds.
+'''
+def enum_cold_stats(fenum):
+	_yappi.enum_cold_stats(fenum)
+
+def print_cold_stats():
+	li = []
+	enum_cold_stats(li.append)
+	li.sort(key=lambda e: e[1], reverse=True)
+	print "\n\nname                                 first      #cold    cold avg   #n       steady avg"
+	for e in li:
+		print "%-36.36s %-10.6f %-8d %-10.6f %-8d %-10.6f" % e
+
+'''
+ Calls that take longer than threshold seconds are recorded together with
+ their callstack. Without functions the threshold applies to every function,
+ otherwise only to the given function names and it overrides the global one.
+ A threshold of 0 disables the capture, for the given functions only if
+ they are given. Only the last few slow calls are
+ kept, see get_slow_calls().
+'''
+def set_slow_threshold(threshold, functions=None):
+	_yappi.set_slow_threshold(threshold, functions)
+
+'''
+ Returns a list of (tid, name, tstart, elapsed, depth, stack) tuples for the
+ recorded slow calls, oldest first. stack holds the function names of the
+ callstack with the slow call itself being the last one.
+'''
+def get_slow_calls():
+	return _yappi.get_slow_calls()
+
+def print_slow_calls():
+	for tid, name, tstart, elapsed, depth, stack in get_slow_calls():
+		print "\n%s took %0.6f secs (tid:%d, started:%s, depth:%d)" % (name,
+			elapsed, tid, time.ctime(tstart), depth)
+		for fname in stack:
+			print "    %s" % fname
+
 def clear_stats():
 	_yappi.clear_stats()
 
-if __name__ != "__main__":
-	pass
+'''
+ Tags the calls the current thread makes from now on, e.g. with the endpoint
+ of the request it serves. The calls made under a tag are counted apart from
+ the calls of the same functions under other tags and can be listed with
+ get_stats(tag=...). Their names end with " [tag]", also in the saved
+ profiles. A tag is any hashable value, None removes the tag. It only
+ applies while the thread is profiled.
+'''
+def set_tag(tag):
+	_yappi.set_tag(tag)
+
+'''
+ With green threads (gevent, eventlet) many tasks run on one thread and a
+ task switch mixes up their callstacks. callback returns the id of the
+ running task as an int; every id gets a context and a callstack of its own,
+ e.g. set_context_id_callback(lambda: id(greenlet.getcurrent())). callback
+ may also be a capsule named "yappi.context_id" holding a native
+ long (*)(void) function, which avoids calling into Python on every event.
+ None goes back to per thread contexts. The contexts of tasks that have
+ returned from all their functions are retired. Cannot be used with line
+ profiling, trace or deferred mode and only while the profiler is stopped.
+'''
+def set_context_id_callback(callback):
+	_yappi.set_context_id_callback(callback)
+
+'''
+ Saves the current profile into path. type is one of:
+   ystat:     yappi's compact binary format, see load() and merge(). Functions
+              are identified as filename:name:line in the saved profile.
+   pstat:     marshalled pstats dict, readable by pstats.Stats and the tools
+              built on it.
+   callgrind: callgrind profile for KCachegrind.
+ pstat and callgrind profiles are streamed into the file while the stats are
+ enumerated. Caller edges are not recorded by yappi, so they are left empty.
+'''
+def save(path, type="ystat"):
+	_yappi.save(path, type)
+
+'''
+ Returns the profile saved at path as a (funcs, threads) tuple. funcs holds
+ (name, ncall, ttot, tsub) tuples and threads (class name, tid, scnt, ttot).
+'''
+def load(path):
+	return _yappi.load(path)
+
+'''
+ Merges the profiles saved at paths into a single profile written to path.
+ Stats of the same function are added up.
+'''
+def merge(paths, path):
+	_yappi.merge(paths, path)
+
+'''
+ Starts a native background thread that writes the profile every interval
+ seconds into dir as yappi.<pid>.<time>.<seq>.<type> files (see save() for the
+ types) without stopping the profiler. If reset is set, the counters start
+ over after every profile, so each file holds one interval. The oldest files
+ are removed when the written ones exceed max_bytes; the newest file is
+ always kept. The agent is stopped at exit.
+'''
+def start_agent(dir, interval=3600, max_bytes=100<<20, type="ystat", reset=True):
+	import atexit
+
+	_yappi.start_agent(os.path.join(dir, "yappi.%d" % os.getpid()), interval,
+					   max_bytes, type, reset)
+	if not _agent_atexit:
+		atexit.register(_stop_agent_atexit)
+		_agent_atexit.append(True)
+
+def stop_agent():
+	_yappi.stop_agent()
+
+_agent_atexit = []
+
+def _stop_agent_atexit():
+	try:
+		_yappi.stop_agent()
+	except _yappi.error:
+		pass
+
+_prev_sighandlers = {}
+
+'''
+ Installs signal handlers to profile a running process on demand:
+ toggle_signal (SIGUSR1 by default) starts the profiler with the given start()
+ arguments or stops it, dump_signal (SIGUSR2 by default) saves the current
+ profile to dump_path (formatted with pid and time) in dump_type format, see
+ save(). Python runs signal handlers in the main thread between two
+ bytecodes, so the work is done on a safe point and not in the signal
+ context. A main thread blocked in a long native call delays the handlers.
+ Must be called from the main thread.
+'''
+def install_signal_handlers(toggle_signal=None, dump_signal=None,
+							dump_path="yappi.%(pid)d.%(time)d.prof", dump_type="ystat",
+							**kwargs):
+	import signal
+
+	if toggle_signal is None:
+		toggle_signal = signal.SIGUSR1
+	if dump_signal is None:
+		dump_signal = signal.SIGUSR2
+
+	def toggle(signum, frame):
+		if is_running():
+			stop()
+		else:
+			start(**kwargs)
+
+	def dump(signum, frame):
+		path = dump_path % {"pid": os.getpid(), "time": time.time()}
+		try:
+			save(path, dump_type)
+		except _yappi.error, e:
+			sys.stderr.write("[yappi] profile cannot be saved to %s: %s\n" % (path, e))
+
+	uninstall_signal_handlers()
+	_prev_sighandlers[toggle_signal] = signal.signal(toggle_signal, toggle)
+	_prev_sighandlers[dump_signal] = signal.signal(dump_signal, dump)
+
+'''
+ Restores the signal handlers replaced by install_signal_handlers().
+'''
+def uninstall_signal_handlers():
+	import signal
+
+	for signum, handler in _prev_sighandlers.items():
+		signal.signal(signum, handler)
+	_prev_sighandlers.clear()
+
+'''
+ Converts a trace recorded with start(trace_dir=...) into the Chrome trace
+ event format (JSON) that chrome://tracing and Perfetto load. The record
+ layout is defined in _ytrace.h.
+'''
+def convert_trace(trace_dir, path):
+	import os
+	import glob
+	import json
+	import struct
+
+	HDR_FMT = "=8sIIQQqd"
+	REC_FMT = "=qII"
+	hdrlen = struct.calcsize(HDR_FMT)
+
+	names = {}
+	for line in open(os.path.join(trace_dir, "yappi.names")):
+		id, name = line.rstrip("\r\n").split("\t", 1)
+		names[int(id)] = name
+
+	traces = []
+	for fn in glob.glob(os.path.join(trace_dir, "yappi.*.trace")):
+		f = open(fn, "rb")
+		magic, version, recsize, capacity, head, tid, tf = struct.unpack(HDR_FMT,
+			f.read(hdrlen))
+		if magic != "YAPPITRC" or version != 1:
+			raise ValueError("%s is not a yappi trace file." % fn)
+		first = max(0, head - capacity)
+		data = f.read(capacity * recsize)
+		f.close()
+		recs = [struct.unpack_from(REC_FMT, data, (i % capacity) * recsize)
+				for i in xrange(first, head)]
+		if recs:
+			traces.append((tid, tf, recs))
+	base = 0
+	if traces:
+		base = min([recs[0][0] * tf for tid, tf, recs in traces])
+
+	out = open(path, "w")
+	out.write('{"traceEvents":[\n')
+	sep = ""
+	for tid, tf, recs in traces:
+		depth = 0
+		for t, pit, event in recs:
+			if event == 1: # return
+				if not depth: # entered before the trace began or got overwritten.
+					continue
+				depth -= 1
+				ph = "E"
+			else:
+				depth += 1
+				ph = "B"
+			out.write(sep + json.dumps({"name": names.get(pit, "N/A"), "ph": ph,
+				"ts": (t * tf - base) * 1000000, "pid": 0, "tid": tid}))
+			sep = ",\n"
+		# close the calls that were still active when the trace ended.
+		for i in xrange(depth):
+			out.write(sep + json.dumps({"ph": "E", "ts": (t * tf - base) * 1000000,
+				"pid": 0, "tid": tid}))
+	out.write("\n]}\n")
+	out.close()
+
+'''
+ Reads the live stats published by a process started with
+ start(shm_path=...). The layout is defined in _yshm.h. Returns an
+ (info, funcs, threads) tuple: info is a dict with the pid, tstart, running
+ and dropped fields of the header, funcs holds (name, ncall, ttot, tsub) and
+ threads (class name, tid, scnt, ttot) tuples like load(). Records that stay
+ torn, e.g. the writer died while updating them, are skipped and counted in
+ info["torn"].
+'''
+def read_shm(path):
+	import mmap
+	import struct
+
+	HDR_FMT = "=8s6Iqqd2I"
+	PIT_FMT = "=2IQqq240s"
+	CTX_FMT = "=2IqQq32s"
+	hdrlen = struct.calcsize(HDR_FMT)
+	pitlen = struct.calcsize(PIT_FMT)
+	ctxlen = struct.calcsize(CTX_FMT)
+
+	# a record is consistent if its sequence is even and did not change
+	# while it was copied. None if it is still torn after SHM_READ_RETRIES.
+	def record(m, fmt, off, size):
+		for i in xrange(SHM_READ_RETRIES):
+			seq = struct.unpack_from("=I", m, off)[0]
+			r = struct.unpack(fmt, m[off:off+size])
+			if not seq & 1 and struct.unpack_from("=I", m, off)[0] == seq:
+				return r
+		return None
+
+	f = open(path, "rb")
+	try:
+		m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+	finally:
+		f.close()
+	try:
+		magic, version, pitcap, ctxcap, npits, nctxs, dropped, pid, tstart, tf, \
+			running, timing_sample = struct.unpack(HDR_FMT, m[:hdrlen])
+		if magic != "YAPPISHM" or version != 1:
+			raise ValueError("%s is not a yappi shared memory file." % path)
+		torn = 0
+		funcs = []
+		for i in xrange(min(npits, pitcap)):
+			r = record(m, PIT_FMT, hdrlen + i * pitlen, pitlen)
+			if not r:
+				torn += 1
+				continue
+			seq, builtin, ncall, ttot, tsub, name = r
+			funcs.append((name.rstrip("\0"), ncall, ttot * tf * timing_sample,
+				max(ttot - tsub, 0) * tf * timing_sample))
+		threads = []
+		ctxbase = hdrlen + pitcap * pitlen
+		for i in xrange(min(nctxs, ctxcap)):
+			r = record(m, CTX_FMT, ctxbase + i * ctxlen, ctxlen)
+			if not r:
+				torn += 1
+				continue
+			seq, reserved, tid, scnt, ttot, name = r
+			threads.append((name.rstrip("\0") or "N/A", tid, scnt, ttot * tf))
+	finally:
+		m.close()
+	info = {"pid": pid, "tstart": tstart, "running": running, "dropped": dropped,
+		"torn": torn}
+	return info, funcs, threads
+
+if __name__ == "__main__":
+	if len(sys.argv) == 4 and sys.argv[1] == "chrome":
+		convert_trace(sys.argv[2], sys.argv[3])
+	elif len(sys.argv) > 3 and sys.argv[1] == "merge":
+		merge(sys.argv[3:], sys.argv[2])
+	elif len(sys.argv) == 3 and sys.argv[1] == "shm":
+		info, funcs, threads = read_shm(sys.argv[2])
+		print "pid %d, %s since %s, %d records dropped" % (info["pid"],
+			("stopped", "running")[info["running"] != 0], time.ctime(info["tstart"]),
+			info["dropped"])
+		print "\n%-60s %10s %12s %12s" % ("name", "#n", "tsub", "ttot")
+		for name, ncall, ttot, tsub in sorted(funcs, key=lambda f: f[2], reverse=True)[:40]:
+			print "%-60s %10d %12.6f %12.6f" % (name[-60:], ncall, tsub, ttot)
+		print "\n%-20s %20s %10s %12s" % ("name", "tid", "scnt", "ttot")
+		for name, tid, scnt, ttot in threads:
+			print "%-20s %20d %10d %12.6f" % (name[:20], tid, scnt, ttot)
+	else:
+		print "usage: yappi.py chrome <trace_dir> <output.json>"
+		print "       yappi.py merge <output> <profile> [<profile> ...]"
+		print "       yappi.py shm <shm_path>"
+
 
 